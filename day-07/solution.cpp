@@ -11,8 +11,8 @@ class Node {
   std::string getColor() { return this->color; }
   void addIncoming(Node* n) { this->incoming.push_back(n); }
   void addOutgoing(std::vector<std::pair<Node*, int>>& outgoing) { this->outgoing = outgoing; }
-  std::vector<Node*> getIncoming() { return this->incoming; }
-  std::vector<std::pair<Node*, int>> getOutgoing() { return this->outgoing; }
+  const std::vector<Node*>& getIncoming() const { return this->incoming; }
+  const std::vector<std::pair<Node*, int>>& getOutgoing() const { return this->outgoing; }
 };
 
 class Graph {
@@ -60,6 +60,14 @@ class Graph {
   }
 
   int getSize() { return this->nodes.size(); }
+
+  std::vector<Node*> getNodes() {
+    std::vector<Node*> result;
+    for (auto& [color, node] : this->nodes) {
+      result.push_back(&node);
+    }
+    return result;
+  }
 };
 
 void getPredecessors(Graph& graph, Node* node, std::set<std::string>& currentSet) {
@@ -73,7 +81,7 @@ void getPredecessors(Graph& graph, Node* node, std::set<std::string>& currentSet
   }
 }
 
-void part1(Graph graph) {
+void part1(Graph& graph) {
   std::string shinyGoldName = "shinygold";
   auto shinyGold = graph.getOrCreateNode(shinyGoldName);
   std::set<std::string> predecessors;
@@ -81,22 +89,56 @@ void part1(Graph graph) {
   std::cout << predecessors.size() << std::endl;
 }
 
-int countSubBags(Node* node) {
-  auto outgoing = node->getOutgoing();
-  if (outgoing.size() == 0) {
-    return 1;
+// Number of bags inside a bag of each color that don't fit in 64 bits
+constexpr uint64_t TOO_MANY_BAGS = UINT64_MAX;
+
+// Number of bags for every color, the bag itself included. Bags are visited in topological order (contained bags
+// first), so every count is computed once from the counts of its children. Bags on a cycle, or containing one,
+// get no count, and bags whose count doesn't fit in 64 bits get TOO_MANY_BAGS. Either only affects the bags
+// that (transitively) contain them.
+void countAllSubBags(Graph& graph, std::unordered_map<Node*, uint64_t>& counts) {
+  std::vector<Node*> nodes = graph.getNodes();
+  std::unordered_map<Node*, size_t> pending;  // Children not counted yet
+  std::vector<Node*> ready;
+  for (auto node : nodes) {
+    pending[node] = node->getOutgoing().size();
+    if (node->getOutgoing().empty()) ready.push_back(node);
   }
-  int sum = 1;
-  for (auto out : outgoing) {
-    sum += out.second * countSubBags(out.first);
+
+  counts.clear();
+  while (!ready.empty()) {
+    Node* node = ready.back();
+    ready.pop_back();
+    uint64_t sum = 1;
+    for (auto& [child, num] : node->getOutgoing()) {
+      const uint64_t childCount = counts[child];
+      uint64_t product;
+      if (childCount == TOO_MANY_BAGS || __builtin_mul_overflow(static_cast<uint64_t>(num), childCount, &product) ||
+          __builtin_add_overflow(sum, product, &sum) || sum == TOO_MANY_BAGS) {
+        sum = TOO_MANY_BAGS;
+        break;
+      }
+    }
+    counts[node] = sum;
+    for (auto parent : node->getIncoming()) {
+      if (--pending[parent] == 0) ready.push_back(parent);
+    }
   }
-  return sum;
 }
 
-void part2(Graph graph) {
+void part2(Graph& graph) {
   std::string shinyGoldName = "shinygold";
   auto shinyGold = graph.getOrCreateNode(shinyGoldName);
-  std::cout << countSubBags(shinyGold) - 1 << std::endl;
+  std::unordered_map<Node*, uint64_t> counts;
+  countAllSubBags(graph, counts);
+  auto search = counts.find(shinyGold);
+  if (search == counts.end()) {
+    std::cerr << "Shiny gold bags contain a cycle" << std::endl;
+  } else if (search->second == TOO_MANY_BAGS) {
+    std::cerr << "Number of bags in a shiny gold bag doesn't fit in 64 bits" << std::endl;
+  } else {
+    std::cout << search->second - 1 << std::endl;
+  }
 }
 
 int main() {
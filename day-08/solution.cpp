@@ -1,3 +1,6 @@
+#include <numeric>
+#include <thread>
+
 #include "solution.hpp"
 
 void nop(Program& p, Instruction& i) { p.changePc(1); }
@@ -44,6 +47,47 @@ bool Instruction::switchType() {
 
 bool Program::changeInstruction(int index) { return this->instructions[index].switchType(); }
 
+bool Vm::changeInstruction(size_t index) {
+  Opcode& opcode = this->code[index].opcode;
+  if (!isRepairable(opcode)) return false;
+  opcode = repairedOpcode(opcode);
+  return true;
+}
+
+// Return true if loop detected (or cancelled), false otherwise
+bool SharedCodeVm::runUntilLoop(size_t flipped, const std::atomic<bool>& cancel) {
+  const size_t size = this->code.size();
+  size_t steps = 0;
+  while (static_cast<size_t>(this->pc) < size) {
+    uint64_t& word = this->visited[this->pc / 64];
+    const uint64_t bit = uint64_t(1) << (this->pc % 64);
+    if (word & bit) break;
+    word |= bit;
+    if (++steps % 1024 == 0 && cancel.load(std::memory_order_relaxed)) return true;
+
+    const PackedInstruction& instr = this->code[this->pc];
+    const Opcode opcode = static_cast<size_t>(this->pc) == flipped ? repairedOpcode(instr.opcode) : instr.opcode;
+    this->pc = step(opcode, instr.arg, this->pc, this->acc);
+  }
+  return static_cast<size_t>(this->pc) < size;
+}
+
+// New instructions need an entry here, a case in step() and, if they can be repaired, a case in repairedOpcode()
+const std::vector<std::pair<std::string, Opcode>> opcodeNames = {
+    {"nop", Opcode::NOP}, {"acc", Opcode::ACC}, {"jmp", Opcode::JMP}};
+
+PackedInstruction parsePackedInputLine(std::string& line) {
+  size_t space = line.find(' ');
+  std::string name = line.substr(0, space);
+  for (auto& [opcodeName, opcode] : opcodeNames) {
+    if (name == opcodeName) {
+      return {opcode, static_cast<int32_t>(std::atoi(line.c_str() + space + 1))};
+    }
+  }
+  std::cerr << "Invalid instruction " << name << std::endl;
+  std::terminate();
+}
+
 Instruction parseInputLine(std::string& line) {
   std::vector<std::string> v;
   boost::split(v, line, boost::is_any_of(" "));
@@ -70,12 +114,169 @@ void part2(Program program) {
   program.runUntilLoop();
 }
 
+void part1(Vm vm) {
+  vm.runUntilLoop();
+  std::cout << vm.getAcc() << std::endl;
+}
+
+void part2(Vm vm) {
+  for (size_t i = 0; i < vm.getNumInstructions(); ++i) {
+    bool switched = vm.changeInstruction(i);
+    if (switched) {
+      bool looped = vm.runUntilLoop();
+      if (!looped) {
+        std::cout << vm.getAcc() << std::endl;
+      }
+      vm.changeInstruction(i);
+      vm.reset();
+    }
+  }
+}
+
+// Index of the instruction that runs after instruction i (may be out of range, which means termination)
+int64_t nextPc(const PackedInstruction& instr, int64_t i, bool flipped = false) {
+  int64_t acc = 0;
+  return step(flipped ? repairedOpcode(instr.opcode) : instr.opcode, instr.arg, i, acc);
+}
+
+// Linear time: mark all instructions from which the program terminates (by walking the reversed control
+// flow graph from the instructions that jump out of the program), then run the program once and flip
+// the first nop/jmp that leads into a marked instruction.
+void part2Linear(Vm vm) {
+  const auto& code = vm.getCode();
+  const int64_t size = code.size();
+  auto inRange = [size](int64_t pc) { return pc >= 0 && pc < size; };
+
+  // Reversed edges in compressed form: predecessors of i are predecessors[first[i]..first[i + 1])
+  std::vector<size_t> first(size + 1, 0);
+  for (int64_t i = 0; i < size; ++i) {
+    int64_t next = nextPc(code[i], i);
+    if (inRange(next)) ++first[next + 1];
+  }
+  for (int64_t i = 0; i < size; ++i) first[i + 1] += first[i];
+  std::vector<int64_t> predecessors(first[size]);
+  std::vector<size_t> fill(first.begin(), first.end() - 1);
+  std::vector<int64_t> stack;
+  for (int64_t i = 0; i < size; ++i) {
+    int64_t next = nextPc(code[i], i);
+    if (inRange(next)) {
+      predecessors[fill[next]++] = i;
+    } else {
+      stack.push_back(i);
+    }
+  }
+
+  std::vector<bool> terminates(size, false);
+  for (int64_t i : stack) terminates[i] = true;
+  while (!stack.empty()) {
+    int64_t i = stack.back();
+    stack.pop_back();
+    for (size_t p = first[i]; p < first[i + 1]; ++p) {
+      if (!terminates[predecessors[p]]) {
+        terminates[predecessors[p]] = true;
+        stack.push_back(predecessors[p]);
+      }
+    }
+  }
+
+  std::vector<bool> visited(size, false);
+  for (int64_t pc = 0; inRange(pc) && !visited[pc]; pc = nextPc(code[pc], pc)) {
+    visited[pc] = true;
+    if (!isRepairable(code[pc].opcode)) continue;
+    int64_t alternative = nextPc(code[pc], pc, true);
+    if (!inRange(alternative) || terminates[alternative]) {
+      vm.changeInstruction(pc);
+      vm.runUntilLoop();
+      std::cout << vm.getAcc() << std::endl;
+      return;
+    }
+  }
+  std::cerr << "No solution" << std::endl;
+}
+
+// Brute force over all nop/jmp instructions, split across threads. The first worker that finds a
+// terminating program cancels the others.
+void part2Parallel(const Vm& vm, unsigned int numThreads) {
+  const auto& code = vm.getCode();
+  numThreads = std::max(1u, numThreads);
+  std::atomic<bool> found(false);
+  int64_t result = 0;
+
+  auto worker = [&code, numThreads, &found, &result](size_t id) {
+    SharedCodeVm state(code);
+    for (size_t i = id; i < code.size() && !found; i += numThreads) {
+      if (!isRepairable(code[i].opcode)) continue;
+      bool looped = state.runUntilLoop(i, found);
+      bool expected = false;
+      if (!looped && found.compare_exchange_strong(expected, true)) {
+        result = state.getAcc();
+      }
+      state.reset();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t id = 0; id < numThreads; ++id) {
+    threads.push_back(std::thread(worker, id));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  if (found) {
+    std::cout << result << std::endl;
+  } else {
+    std::cerr << "No solution" << std::endl;
+  }
+}
+
+// Runs the program with tracing for at most maxSteps instructions (it doesn't stop at the first loop) and
+// prints the most executed instructions and the detected loop
+void profile(Vm vm, uint64_t maxSteps = 1000000) {
+  ExecutionTracer tracer(vm.getNumInstructions());
+  const bool running = vm.run(tracer, maxSteps);
+
+  std::cout << "Steps: " << tracer.getSteps() << (running ? " (stopped)" : " (terminated)") << std::endl;
+  if (tracer.getLoopEntry() >= 0) {
+    std::cout << "Loop entered at " << tracer.getLoopEntry() << ", length " << tracer.getLoopLength() << std::endl;
+  }
+  const auto& hits = tracer.getHitCounts();
+  std::vector<size_t> order(hits.size());
+  std::iota(order.begin(), order.end(), 0);
+  const size_t top = std::min<size_t>(10, order.size());
+  std::partial_sort(order.begin(), order.begin() + top, order.end(),
+                    [&hits](size_t a, size_t b) { return hits[a] > hits[b]; });
+  for (size_t k = 0; k < top && hits[order[k]] > 0; ++k) {
+    std::cout << "\t" << order[k] << ": " << hits[order[k]] << std::endl;
+  }
+}
+
+enum class Repair { BRUTE_FORCE, LINEAR, PARALLEL };
+
 int main() {
   const std::string filename = "../day-08/input.txt";
-  auto parsed_input = aoc::readParseInput(filename, parseInputLine);
-  auto program = Program(parsed_input);
-  part1(program);
-  part2(program);
+  const bool packed = true;  // false runs the original std::function based Program
+  const Repair repair = Repair::LINEAR;
+
+  if (!packed) {
+    auto program = Program(aoc::readParseInput(filename, parseInputLine));
+    part1(program);
+    part2(program);
+    return 0;
+  }
+
+  auto parsed_input = aoc::readParseInput(filename, parsePackedInputLine);
+  auto vm = Vm(parsed_input);
+  const bool trace = false;
+  if (trace) profile(vm);
+  part1(vm);
+  if (repair == Repair::LINEAR) {
+    part2Linear(vm);
+  } else if (repair == Repair::PARALLEL) {
+    part2Parallel(vm, std::thread::hardware_concurrency());
+  } else {
+    part2(vm);
+  }
 
   return 0;
 }
@@ -1,3 +1,5 @@
+#include <atomic>
+
 #include "aoclib.hpp"
 
 class Instruction;
@@ -39,3 +41,203 @@ class Instruction {
   void exec(Program& p) { this->func(p, *this); }
   bool switchType();
 };
+
+enum class Opcode : uint8_t { NOP, ACC, JMP };
+
+struct PackedInstruction {
+  Opcode opcode;
+  int32_t arg;
+};
+
+// Opcode after repairing the instruction (nop <-> jmp), the same opcode if it can't be repaired
+inline Opcode repairedOpcode(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::NOP:
+      return Opcode::JMP;
+    case Opcode::JMP:
+      return Opcode::NOP;
+    default:
+      return opcode;
+  }
+}
+
+inline bool isRepairable(Opcode opcode) { return repairedOpcode(opcode) != opcode; }
+
+// Executes one instruction: updates acc and returns the next pc. Every VM dispatches through here.
+inline int64_t step(Opcode opcode, int32_t arg, int64_t pc, int64_t& acc) {
+  switch (opcode) {
+    case Opcode::NOP:
+      return pc + 1;
+    case Opcode::ACC:
+      acc += arg;
+      return pc + 1;
+    case Opcode::JMP:
+      return pc + arg;
+  }
+  return pc + 1;
+}
+
+// Default tracer for Vm: does nothing, so the calls compile away
+struct NoTracer {
+  void onStep(int64_t, const PackedInstruction&, int64_t) {}
+  void onLoop(int64_t) {}
+};
+
+// Records how often each instruction ran, where the program entered a loop, and the last
+// `capacity` executed instructions in a ring buffer of compact records
+class ExecutionTracer {
+ public:
+  struct Record {
+    uint32_t pc;
+    Opcode opcode;
+    int64_t acc;  // Before the instruction was executed
+  };
+
+ private:
+  std::vector<uint64_t> hitCounts;
+  std::vector<uint64_t> firstStep;  // Step at which each instruction first ran
+  std::vector<Record> ring;
+  uint64_t steps;
+  int64_t loopEntry;
+  uint64_t loopLength;
+
+ public:
+  // Capacity is rounded up to a power of two
+  ExecutionTracer(size_t numInstructions, size_t capacity = 1024)
+      : hitCounts(numInstructions, 0), firstStep(numInstructions, 0), steps(0), loopEntry(-1), loopLength(0) {
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+    this->ring.resize(size);
+  }
+
+  void onStep(int64_t pc, const PackedInstruction& instr, int64_t acc) {
+    if (this->hitCounts[pc]++ == 0) this->firstStep[pc] = this->steps;
+    this->ring[this->steps & (this->ring.size() - 1)] = {static_cast<uint32_t>(pc), instr.opcode, acc};
+    ++this->steps;
+  }
+
+  void onLoop(int64_t pc) {
+    this->loopEntry = pc;
+    this->loopLength = this->steps - this->firstStep[pc];
+  }
+
+  uint64_t getSteps() const { return this->steps; }
+  const std::vector<uint64_t>& getHitCounts() const { return this->hitCounts; }
+  int64_t getLoopEntry() const { return this->loopEntry; }  // -1 if no loop was detected
+  uint64_t getLoopLength() const { return this->loopLength; }
+
+  // Records in execution order, oldest first
+  std::vector<Record> getTrace() const {
+    std::vector<Record> trace;
+    const uint64_t numRecords = std::min<uint64_t>(this->steps, this->ring.size());
+    for (uint64_t s = this->steps - numRecords; s < this->steps; ++s) {
+      trace.push_back(this->ring[s & (this->ring.size() - 1)]);
+    }
+    return trace;
+  }
+
+  // Fields are written one after the other (13 bytes per record, host byte order), so no padding ends up in the output
+  void writeTrace(std::ostream& out) const {
+    for (const Record& r : this->getTrace()) {
+      out.write(reinterpret_cast<const char*>(&r.pc), sizeof(r.pc));
+      out.write(reinterpret_cast<const char*>(&r.opcode), sizeof(r.opcode));
+      out.write(reinterpret_cast<const char*>(&r.acc), sizeof(r.acc));
+    }
+  }
+};
+
+// Same semantics as Program, but instructions are packed PODs dispatched through a switch and the
+// executed instructions are kept in a bitset
+class Vm {
+ private:
+  int64_t pc;
+  int64_t acc;
+  std::vector<PackedInstruction> code;
+  std::vector<uint64_t> visited;
+
+ public:
+  Vm(std::vector<PackedInstruction> code) : pc(0), acc(0), code(code), visited((code.size() + 63) / 64, 0) {}
+  int64_t getAcc() const { return this->acc; }
+  int64_t getPc() const { return this->pc; }
+  size_t getNumInstructions() const { return this->code.size(); }
+  const std::vector<PackedInstruction>& getCode() const { return this->code; }
+  bool runUntilLoop() {
+    NoTracer tracer;
+    return this->runUntilLoop(tracer);
+  }
+  template <class Tracer>
+  bool runUntilLoop(Tracer& tracer);
+  template <class Tracer>
+  bool run(Tracer& tracer, uint64_t maxSteps);
+  void reset() {
+    this->pc = 0;
+    this->acc = 0;
+    std::fill(this->visited.begin(), this->visited.end(), 0);
+  }
+  bool changeInstruction(size_t index);
+};
+
+// Return true if loop detected, false otherwise
+template <class Tracer>
+bool Vm::runUntilLoop(Tracer& tracer) {
+  const size_t size = this->code.size();
+  while (static_cast<size_t>(this->pc) < size) {
+    uint64_t& word = this->visited[this->pc / 64];
+    const uint64_t bit = uint64_t(1) << (this->pc % 64);
+    if (word & bit) {
+      tracer.onLoop(this->pc);
+      break;
+    }
+    word |= bit;
+
+    const PackedInstruction& instr = this->code[this->pc];
+    tracer.onStep(this->pc, instr, this->acc);
+    this->pc = step(instr.opcode, instr.arg, this->pc, this->acc);
+  }
+  return static_cast<size_t>(this->pc) < size;
+}
+
+// Unlike runUntilLoop, keeps running after an instruction repeats (the tracer is told about the first
+// repetition only) until the program terminates or maxSteps instructions ran.
+// Return true if the program is still running, false if it terminated
+template <class Tracer>
+bool Vm::run(Tracer& tracer, uint64_t maxSteps) {
+  const size_t size = this->code.size();
+  bool loopReported = false;
+  for (uint64_t s = 0; s < maxSteps && static_cast<size_t>(this->pc) < size; ++s) {
+    uint64_t& word = this->visited[this->pc / 64];
+    const uint64_t bit = uint64_t(1) << (this->pc % 64);
+    if (!(word & bit)) {
+      word |= bit;
+    } else if (!loopReported) {
+      tracer.onLoop(this->pc);
+      loopReported = true;
+    }
+
+    const PackedInstruction& instr = this->code[this->pc];
+    tracer.onStep(this->pc, instr, this->acc);
+    this->pc = step(instr.opcode, instr.arg, this->pc, this->acc);
+  }
+  return static_cast<size_t>(this->pc) < size;
+}
+
+// Execution state (pc, acc, executed instructions) over instructions shared with other threads.
+// One instruction can be run as flipped (nop <-> jmp) without changing the shared instructions.
+class SharedCodeVm {
+ private:
+  const std::vector<PackedInstruction>& code;
+  int64_t pc;
+  int64_t acc;
+  std::vector<uint64_t> visited;
+
+ public:
+  SharedCodeVm(const std::vector<PackedInstruction>& code)
+      : code(code), pc(0), acc(0), visited((code.size() + 63) / 64, 0) {}
+  int64_t getAcc() const { return this->acc; }
+  bool runUntilLoop(size_t flipped, const std::atomic<bool>& cancel);
+  void reset() {
+    this->pc = 0;
+    this->acc = 0;
+    std::fill(this->visited.begin(), this->visited.end(), 0);
+  }
+};
@@ -1,17 +1,20 @@
+#include <chrono>
+#include <random>
+
 #include "aoclib.hpp"
 
 class Mask {
  private:
   uint64_t powersSetTo0;
   uint64_t powersSetTo1;
-  std::vector<uint64_t> powersX;
+  uint64_t powersX;  // Bits of the floating (X) positions
 
  public:
   Mask() = default;
   Mask(std::string& line) {
     this->powersSetTo0 = 0;
     this->powersSetTo1 = 0;
-    this->powersX = std::vector<uint64_t>();
+    this->powersX = 0;
 
     std::string mask = line.substr(7);
     uint64_t p = 1;
@@ -25,7 +28,7 @@ class Mask {
           this->powersSetTo1 += p;
           break;
         case 'X':
-          this->powersX.push_back(p);
+          this->powersX += p;
           break;
         default:
           std::cerr << "Invalid mask element: " << mask[mask.size() - 1 - i] << std::endl;
@@ -38,7 +41,7 @@ class Mask {
 
   uint64_t getPowersSetTo0() const { return this->powersSetTo0; }
   uint64_t getPowersSetTo1() const { return this->powersSetTo1; }
-  std::vector<uint64_t> getPowersX() const { return this->powersX; }
+  uint64_t getPowersX() const { return this->powersX; }
 };
 
 std::ostream& operator<<(std::ostream& output, const Mask& m) {
@@ -54,8 +57,8 @@ class Write {
   Write(std::string& line) {
     std::vector<std::string> v;
     boost::split(v, line, boost::is_any_of(" []="));
-    this->memLoc = static_cast<uint64_t>(std::stoi(v[1]));
-    this->val = static_cast<uint64_t>(std::stoi(v[5]));
+    this->memLoc = std::stoull(v[1]);
+    this->val = std::stoull(v[5]);
   }
 
   uint64_t getMemLoc() const { return this->memLoc; }
@@ -78,9 +81,110 @@ Instruction parseInputLine(std::string& line) {
   }
 }
 
+// Hash map from address to value with open addressing and linear probing. All entries live in one array
+// whose size is a power of two. UINT64_MAX marks empty slots, so that key is stored separately.
+class FlatMap {
+ private:
+  static constexpr uint64_t EMPTY = UINT64_MAX;
+  std::vector<std::pair<uint64_t, uint64_t>> slots;
+  std::pair<uint64_t, uint64_t> emptyKeyEntry;  // Entry for the key EMPTY, if hasEmptyKey
+  bool hasEmptyKey;
+  size_t numEntries;
+  int shift;  // 64 - log2(capacity)
+
+  size_t slotOf(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ULL) >> this->shift; }
+
+  void rehash(size_t capacity) {
+    std::vector<std::pair<uint64_t, uint64_t>> old = std::move(this->slots);
+    this->slots.assign(capacity, {EMPTY, 0});
+    this->shift = 64 - __builtin_ctzll(capacity);
+    for (auto& entry : old) {
+      if (entry.first == EMPTY) continue;
+      size_t i = this->slotOf(entry.first);
+      while (this->slots[i].first != EMPTY) i = (i + 1) & (capacity - 1);
+      this->slots[i] = entry;
+    }
+  }
+
+ public:
+  // Visits the occupied slots, then extra (if not null). current is null once all entries were visited.
+  class Iterator {
+   private:
+    const std::pair<uint64_t, uint64_t>* current;
+    const std::pair<uint64_t, uint64_t>* end;
+    const std::pair<uint64_t, uint64_t>* extra;
+
+    void skipEmpty() {
+      while (this->current != this->end && this->current->first == EMPTY) ++this->current;
+      if (this->current != this->end) return;
+      if (this->extra != nullptr) {
+        this->current = this->extra;
+        this->end = this->extra + 1;
+        this->extra = nullptr;
+      } else {
+        this->current = nullptr;
+      }
+    }
+
+   public:
+    Iterator(const std::pair<uint64_t, uint64_t>* current, const std::pair<uint64_t, uint64_t>* end,
+             const std::pair<uint64_t, uint64_t>* extra)
+        : current(current), end(end), extra(extra) {
+      this->skipEmpty();
+    }
+    const std::pair<uint64_t, uint64_t>& operator*() const { return *this->current; }
+    Iterator& operator++() {
+      ++this->current;
+      this->skipEmpty();
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const { return this->current != other.current; }
+  };
+
+  FlatMap() : emptyKeyEntry(EMPTY, 0), hasEmptyKey(false), numEntries(0) { this->rehash(16); }
+
+  // Makes room for n entries without growing (the load factor stays below 1/2)
+  void reserve(size_t n) {
+    size_t capacity = this->slots.size();
+    while (capacity < 2 * n) capacity *= 2;
+    if (capacity != this->slots.size()) this->rehash(capacity);
+  }
+
+  uint64_t& operator[](uint64_t key) {
+    if (key == EMPTY) {
+      if (!this->hasEmptyKey) {
+        this->hasEmptyKey = true;
+        ++this->numEntries;
+      }
+      return this->emptyKeyEntry.second;
+    }
+    const size_t mask = this->slots.size() - 1;
+    size_t i = this->slotOf(key);
+    while (this->slots[i].first != EMPTY) {
+      if (this->slots[i].first == key) return this->slots[i].second;
+      i = (i + 1) & mask;
+    }
+    if (4 * (this->numEntries + 1) > 3 * this->slots.size()) {
+      this->rehash(2 * this->slots.size());
+      return (*this)[key];
+    }
+    ++this->numEntries;
+    this->slots[i] = {key, 0};
+    return this->slots[i].second;
+  }
+
+  size_t size() const { return this->numEntries; }
+  Iterator begin() const {
+    return Iterator(this->slots.data(), this->slots.data() + this->slots.size(),
+                    this->hasEmptyKey ? &this->emptyKeyEntry : nullptr);
+  }
+  Iterator end() const { return Iterator(nullptr, nullptr, nullptr); }
+};
+
+template <class Memory = FlatMap>
 class Runtime {
  private:
-  std::unordered_map<uint64_t, uint64_t> memory;
+  Memory memory;
   Mask mask;
 
   uint64_t getMaskedValue(uint64_t value, bool v2) {
@@ -90,27 +194,22 @@ class Runtime {
     return result;
   }
 
-  void writeToMemory(uint64_t value, uint64_t partiallyFixedAddress, int numFixed = 0) {
-    std::vector<uint64_t> powersX = this->mask.getPowersX();
-    if (numFixed == powersX.size()) {
-      // All bits fixed, write to memory
-      this->memory[partiallyFixedAddress] = value;
-      return;
-    }
-    uint64_t currentPower = powersX[numFixed];
-
-    uint64_t address0 = partiallyFixedAddress &= (UINT64_MAX - currentPower);
-    writeToMemory(value, address0, numFixed + 1);
-
-    uint64_t address1 = partiallyFixedAddress |= currentPower;
-    writeToMemory(value, address1, numFixed + 1);
+  // Writes to every address obtained by setting the floating bits to any combination of 0 and 1.
+  // (subset - powersX) & powersX steps through all subsets of powersX, starting and ending with 0.
+  void writeToMemory(uint64_t value, uint64_t partiallyFixedAddress) {
+    const uint64_t powersX = this->mask.getPowersX();
+    const uint64_t base = partiallyFixedAddress & ~powersX;
+    uint64_t subset = 0;
+    do {
+      this->memory[base | subset] = value;
+      subset = (subset - powersX) & powersX;
+    } while (subset != 0);
   }
 
  public:
-  Runtime() {
-    this->memory = std::unordered_map<uint64_t, uint64_t>();
-    this->mask = Mask();
-  }
+  Runtime() { this->mask = Mask(); }
+
+  void reserve(size_t numAddresses) { this->memory.reserve(numAddresses); }
 
   void executeInstruction(Instruction& instr, bool v2 = false) {
     if (std::holds_alternative<Write>(instr)) {
@@ -140,18 +239,283 @@ class Runtime {
   }
 };
 
-void solve(std::vector<Instruction>& instructions, bool v2 = false) {
-  Runtime runtime;
+// Set of addresses: bits outside `floating` are fixed to `bits`, bits in `floating` can be anything
+struct AddressPattern {
+  uint64_t bits;
+  uint64_t floating;
+
+  uint64_t size() const { return uint64_t(1) << __builtin_popcountll(this->floating); }
+
+  bool intersects(const AddressPattern& other) const {
+    return ((this->bits ^ other.bits) & ~this->floating & ~other.floating) == 0;
+  }
+
+  // Appends disjoint patterns that together cover all addresses of this pattern that are not in other
+  void subtract(const AddressPattern& other, std::vector<AddressPattern>& out) const {
+    if (!this->intersects(other)) {
+      out.push_back(*this);
+      return;
+    }
+    AddressPattern rest = *this;
+    uint64_t split = this->floating & ~other.floating;
+    while (split != 0) {
+      const uint64_t bit = split & -split;
+      split &= split - 1;
+      rest.floating &= ~bit;
+      // The piece that differs from other in this bit, the rest agrees with it
+      out.push_back({rest.bits | (~other.bits & bit), rest.floating});
+      rest.bits |= other.bits & bit;
+    }
+  }
+};
+
+// Memory for v2 that stores writes as address patterns instead of expanding them into addresses
+class SymbolicMemory {
+ private:
+  std::vector<std::pair<AddressPattern, uint64_t>> writes;
+
+ public:
+  void write(uint64_t address, uint64_t floating, uint64_t value) {
+    this->writes.push_back({{address & ~floating, floating}, value});
+  }
+
+  // Goes through the writes from the last one; each write contributes its value once for every address
+  // that no later write overwrote. `covered` is kept as a list of disjoint patterns.
+  uint64_t getMemorySum() const {
+    uint64_t sum = 0;
+    std::vector<AddressPattern> covered;
+    std::vector<AddressPattern> visible;
+    std::vector<AddressPattern> next;
+    for (auto it = this->writes.rbegin(); it != this->writes.rend(); ++it) {
+      visible = {it->first};
+      for (const AddressPattern& c : covered) {
+        next.clear();
+        for (const AddressPattern& v : visible) v.subtract(c, next);
+        visible.swap(next);
+        if (visible.empty()) break;
+      }
+      for (const AddressPattern& v : visible) {
+        sum += it->second * v.size();
+        covered.push_back(v);
+      }
+    }
+    return sum;
+  }
+};
+
+// The estimates below are upper bounds (writes to the same address are counted again), so memory is reserved
+// for at most this many addresses up front and grows from there if needed
+constexpr size_t MAX_RESERVE = size_t(1) << 16;
+
+// Upper bound on the number of distinct addresses the program writes to, capped at maxHint
+size_t estimateNumAddresses(std::vector<Instruction>& instructions, bool v2, size_t maxHint = MAX_RESERVE) {
+  size_t estimate = 0;
+  uint64_t powersX = 0;
+  for (auto& instr : instructions) {
+    if (std::holds_alternative<Mask>(instr)) {
+      powersX = std::get<Mask>(instr).getPowersX();
+    } else {
+      const int numX = v2 ? __builtin_popcountll(powersX) : 0;
+      estimate += numX < 63 ? size_t(1) << numX : maxHint;
+      if (estimate >= maxHint) return maxHint;
+    }
+  }
+  return estimate;
+}
+
+template <class Memory>
+uint64_t runProgram(std::vector<Instruction>& instructions, bool v2) {
+  Runtime<Memory> runtime;
+  runtime.reserve(estimateNumAddresses(instructions, v2));
   for (auto& instr : instructions) runtime.executeInstruction(instr, v2);
-  std::cout << runtime.getMemorySum() << std::endl;
+  return runtime.getMemorySum();
+}
+
+void solve(std::vector<Instruction>& instructions, bool v2 = false) {
+  std::cout << runProgram<FlatMap>(instructions, v2) << std::endl;
+}
+
+struct PackedMask {
+  uint64_t and0;      // Bits set to 0 by the mask are 0 here
+  uint64_t or1;       // Bits set to 1 by the mask
+  uint64_t floating;  // X bits
+};
+
+struct PackedWrite {
+  uint64_t address;
+  uint64_t value;
+};
+
+// Program as plain arrays: the writes that follow masks[m] are writes[firstWrite[m]] up to
+// writes[firstWrite[m + 1]] (the last entry of firstWrite is writes.size())
+struct PackedProgram {
+  std::vector<PackedMask> masks;
+  std::vector<PackedWrite> writes;
+  std::vector<size_t> firstWrite;
+};
+
+uint64_t parseNumber(const std::string& line, size_t& pos) {
+  uint64_t value = 0;
+  while (pos < line.size() && isdigit(line[pos])) {
+    if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, line[pos] - '0', &value)) {
+      std::cerr << "Number doesn't fit in 64 bits: " << line << std::endl;
+      std::terminate();
+    }
+    ++pos;
+  }
+  return value;
+}
+
+// Reads the file line by line straight into a PackedProgram
+PackedProgram readPackedProgram(const std::string& filename) {
+  PackedProgram program;
+  std::fstream file;
+  file.open(filename, std::ios::in);
+  if (!file.is_open()) {
+    std::cerr << "Can't open file " << filename << std::endl;
+    return program;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.compare(0, 7, "mask = ") == 0) {
+      PackedMask mask = {UINT64_MAX, 0, 0};
+      for (size_t i = 7; i < line.size(); ++i) {
+        const uint64_t bit = uint64_t(1) << (line.size() - 1 - i);
+        if (line[i] == '0') {
+          mask.and0 &= ~bit;
+        } else if (line[i] == '1') {
+          mask.or1 |= bit;
+        } else if (line[i] == 'X') {
+          mask.floating |= bit;
+        } else {
+          std::cerr << "Invalid mask element: " << line[i] << std::endl;
+        }
+      }
+      program.masks.push_back(mask);
+      program.firstWrite.push_back(program.writes.size());
+    } else if (line.compare(0, 4, "mem[") == 0) {
+      if (program.masks.empty()) {
+        // Writes before the first mask are not changed
+        program.masks.push_back({UINT64_MAX, 0, 0});
+        program.firstWrite.push_back(0);
+      }
+      size_t pos = 4;
+      const uint64_t address = parseNumber(line, pos);
+      pos = line.find('=', pos) + 2;
+      program.writes.push_back({address, parseNumber(line, pos)});
+    } else if (line != "") {
+      std::cerr << "Invalid instruction " << line << std::endl;
+      std::terminate();
+    }
+  }
+  program.firstWrite.push_back(program.writes.size());
+  return program;
+}
+
+template <class Memory>
+uint64_t runPackedProgram(const PackedProgram& program, bool v2) {
+  size_t numAddresses = 0;
+  for (size_t m = 0; m < program.masks.size(); ++m) {
+    const int numX = v2 ? __builtin_popcountll(program.masks[m].floating) : 0;
+    numAddresses += (program.firstWrite[m + 1] - program.firstWrite[m]) << std::min(numX, 16);
+  }
+  Memory memory;
+  memory.reserve(std::min(numAddresses, MAX_RESERVE));
+
+  for (size_t m = 0; m < program.masks.size(); ++m) {
+    const PackedMask mask = program.masks[m];
+    for (size_t w = program.firstWrite[m]; w < program.firstWrite[m + 1]; ++w) {
+      const PackedWrite write = program.writes[w];
+      if (!v2) {
+        memory[write.address] = (write.value & mask.and0) | mask.or1;
+        continue;
+      }
+      const uint64_t base = (write.address | mask.or1) & ~mask.floating;
+      uint64_t subset = 0;
+      do {
+        memory[base | subset] = write.value;
+        subset = (subset - mask.floating) & mask.floating;
+      } while (subset != 0);
+    }
+  }
+
+  uint64_t sum = 0;
+  for (auto& val : memory) sum += val.second;
+  return sum;
+}
+
+uint64_t getSymbolicMemorySum(const PackedProgram& program) {
+  SymbolicMemory memory;
+  for (size_t m = 0; m < program.masks.size(); ++m) {
+    const PackedMask mask = program.masks[m];
+    for (size_t w = program.firstWrite[m]; w < program.firstWrite[m + 1]; ++w) {
+      memory.write(program.writes[w].address | mask.or1, mask.floating, program.writes[w].value);
+    }
+  }
+  return memory.getMemorySum();
+}
+
+// Random program with numMasks masks (each with numX floating bits), each followed by writesPerMask writes
+std::vector<Instruction> generateProgram(size_t numMasks, size_t writesPerMask, size_t numX) {
+  std::mt19937_64 rng(2020);
+  std::vector<Instruction> program;
+  for (size_t m = 0; m < numMasks; ++m) {
+    std::string mask(36, '0');
+    for (char& c : mask) c = rng() % 2 ? '1' : '0';
+    for (size_t x = 0; x < numX;) {
+      char& c = mask[rng() % 36];
+      if (c != 'X') {
+        c = 'X';
+        ++x;
+      }
+    }
+    std::string line = "mask = " + mask;
+    program.push_back(parseInputLine(line));
+    for (size_t w = 0; w < writesPerMask; ++w) {
+      line = "mem[" + std::to_string(rng() % 65536) + "] = " + std::to_string(rng() % 1000000000);
+      program.push_back(parseInputLine(line));
+    }
+  }
+  return program;
+}
+
+template <class Memory>
+void benchOne(const std::string& name, std::vector<Instruction>& program, bool v2) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t sum = runProgram<Memory>(program, v2);
+  auto end = std::chrono::steady_clock::now();
+  std::cout << name << (v2 ? " v2: " : " v1: ") << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms (sum " << sum << ")" << std::endl;
+}
+
+// Compares FlatMap with std::unordered_map on a large generated program
+void bench() {
+  std::vector<Instruction> program = generateProgram(1000, 10, 8);
+  for (bool v2 : {false, true}) {
+    benchOne<std::unordered_map<uint64_t, uint64_t>>("std::unordered_map", program, v2);
+    benchOne<FlatMap>("FlatMap", program, v2);
+  }
 }
 
 int main() {
   const std::string filename = "../day-14/input.txt";
-  std::vector<Instruction> input = aoc::readParseInput(filename, parseInputLine);
+  const bool packed = true;  // false runs the Instruction based Runtime for both stars
+
+  if (!packed) {
+    std::vector<Instruction> input = aoc::readParseInput(filename, parseInputLine);
+    solve(input);
+    solve(input, true);
+    return 0;
+  }
+
+  PackedProgram program = readPackedProgram(filename);
+
+  std::cout << runPackedProgram<FlatMap>(program, false) << std::endl;
+  std::cout << getSymbolicMemorySum(program) << std::endl;
 
-  solve(input);
-  solve(input, true);
+  const bool runBench = false;
+  if (runBench) bench();
 
   return 0;
 }
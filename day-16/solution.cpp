@@ -48,7 +48,7 @@ class Ticket {
     }
   }
 
-  std::vector<unsigned int> getValues() const { return values; }
+  const std::vector<unsigned int>& getValues() const { return values; }
   unsigned int getValue(unsigned int idx) const { return values[idx]; }
 };
 
@@ -57,69 +57,184 @@ std::ostream& operator<<(std::ostream& output, const Ticket& t) {
   return output;
 }
 
+/*
+ * Ticket columns
+ */
+
+// Tickets stored by position: getColumn(i)[t] is value i of ticket t
+class TicketColumns {
+ private:
+  std::vector<std::vector<uint32_t>> columns;
+  size_t numTickets;
+
+ public:
+  TicketColumns(size_t numColumns) : columns(numColumns), numTickets(0) {}
+  TicketColumns(const std::vector<Ticket>& tickets)
+      : TicketColumns(tickets.empty() ? 0 : tickets[0].getValues().size()) {
+    for (auto& ticket : tickets) this->add(ticket);
+  }
+
+  void add(const Ticket& ticket) {
+    for (size_t i = 0; i < this->columns.size(); ++i) {
+      this->columns[i].push_back(ticket.getValue(i));
+    }
+    ++this->numTickets;
+  }
+
+  size_t getNumColumns() const { return this->columns.size(); }
+  size_t getNumTickets() const { return this->numTickets; }
+  const std::vector<uint32_t>& getColumn(size_t i) const { return this->columns[i]; }
+  uint32_t getValue(size_t ticket, size_t i) const { return this->columns[i][ticket]; }
+
+  // Only the tickets t with keep[t] != 0
+  TicketColumns filter(const std::vector<uint8_t>& keep) const {
+    TicketColumns filtered(this->columns.size());
+    for (size_t i = 0; i < this->columns.size(); ++i) {
+      for (size_t t = 0; t < this->numTickets; ++t) {
+        if (keep[t]) filtered.columns[i].push_back(this->columns[i][t]);
+      }
+    }
+    filtered.numTickets = std::count_if(keep.begin(), keep.end(), [](uint8_t k) { return k != 0; });
+    return filtered;
+  }
+
+  // Sets valid[t] to 1 for tickets whose value in this column is in one of the field's ranges.
+  // The loop has no branches (v - min <= max - min checks a range with one unsigned comparison),
+  // so the compiler can vectorize it.
+  void markValid(size_t column, const Field& field, std::vector<uint8_t>& valid) const {
+    const uint32_t* values = this->columns[column].data();
+    const uint32_t min1 = field.getRange1().first;
+    const uint32_t width1 = field.getRange1().second - min1;
+    const uint32_t min2 = field.getRange2().first;
+    const uint32_t width2 = field.getRange2().second - min2;
+    uint8_t* out = valid.data();
+    const size_t n = this->numTickets;  // Local copy, out could alias it
+    for (size_t t = 0; t < n; ++t) {
+      out[t] |= static_cast<uint8_t>((values[t] - min1 <= width1) | (values[t] - min2 <= width2));
+    }
+  }
+
+  // True if the field fits the values of all tickets in this column
+  bool allValid(size_t column, const Field& field) const {
+    const uint32_t* values = this->columns[column].data();
+    const uint32_t min1 = field.getRange1().first;
+    const uint32_t width1 = field.getRange1().second - min1;
+    const uint32_t min2 = field.getRange2().first;
+    const uint32_t width2 = field.getRange2().second - min2;
+    uint8_t all = 1;
+    for (size_t t = 0; t < this->numTickets; ++t) {
+      all &= static_cast<uint8_t>((values[t] - min1 <= width1) | (values[t] - min2 <= width2));
+    }
+    return all;
+  }
+};
+
 /*
  * Solver (star 2)
  */
 class Solver {
  private:
-  std::vector<std::vector<Field*>> possibilities;
-  const std::vector<Ticket> tickets;
+  // candidates[i] is a bitset (over field indices) of fields that can be at position i
+  std::vector<std::vector<uint64_t>> candidates;
+  std::vector<uint32_t> myTicket;
   std::vector<Field*> fields;
   std::vector<bool> fixed;
+  size_t numWords;
 
- public:
-  Solver(std::vector<Field>& fields, const std::vector<Ticket>& tickets) : tickets(tickets) {
-    this->possibilities = std::vector(fields.size(), std::vector<Field*>());
-    for (auto& field : fields) {
-      for (auto& pos : this->possibilities) {
-        pos.push_back(&field);
-      }
-      this->fields.push_back(&field);
+  bool hasCandidate(size_t position, size_t field) const {
+    return (this->candidates[position][field / 64] >> (field % 64)) & 1;
+  }
+
+  size_t countCandidates(size_t position) const {
+    size_t count = 0;
+    for (uint64_t word : this->candidates[position]) count += __builtin_popcountll(word);
+    return count;
+  }
+
+  size_t firstCandidate(size_t position) const {
+    for (size_t w = 0; w < this->numWords; ++w) {
+      if (this->candidates[position][w] != 0) return w * 64 + __builtin_ctzll(this->candidates[position][w]);
     }
-    this->fixed = std::vector<bool>(this->possibilities.size(), false);
+    return this->fields.size();
+  }
 
-    // Remove options where values out of range
-    this->removeImpossible();
+  // Position gets only this field, no other position can have it
+  void fix(size_t position, size_t field) {
+    this->fixed[position] = true;
+    std::fill(this->candidates[position].begin(), this->candidates[position].end(), 0);
+    this->candidates[position][field / 64] = uint64_t(1) << (field % 64);
+    for (size_t j = 0; j < this->candidates.size(); ++j) {
+      if (j != position) this->candidates[j][field / 64] &= ~(uint64_t(1) << (field % 64));
+    }
+  }
 
+  void propagate() {
+    this->fixed = std::vector<bool>(this->candidates.size(), false);
     bool changed1 = true;
     bool changed2 = true;
     while (changed1 || changed2) {
       changed1 = this->fixPositionsWithOneOption();
-      if (changed1) this->removeFixed();
       changed2 = this->fixFieldsWithOnlyOneOption();
-      if (changed2) this->removeFixed();
     }
   }
 
-  std::vector<std::vector<Field*>> getPossibilities() const { return possibilities; }
+ public:
+  // Bitset with all fields set
+  static std::vector<uint64_t> allFields(size_t numFields) {
+    std::vector<uint64_t> all((numFields + 63) / 64, UINT64_MAX);
+    if (numFields % 64 != 0) all.back() = (uint64_t(1) << (numFields % 64)) - 1;
+    return all;
+  }
 
-  void removeImpossible() {
-    for (int fieldIdx = 0; fieldIdx < this->possibilities.size(); ++fieldIdx) {
-      std::vector<Field*>& fieldCandidates = this->possibilities[fieldIdx];
-      std::vector<int> unsuitableCandidatesIdxs;
-      for (int candidateIdx = 0; candidateIdx < fieldCandidates.size(); ++candidateIdx) {
-        for (auto& ticket : this->tickets) {
-          if (!fieldCandidates[candidateIdx]->isValueValid(ticket.getValue(fieldIdx))) {
-            unsuitableCandidatesIdxs.push_back(candidateIdx);
-            break;
-          }
-        }
+  // The last ticket is my ticket
+  Solver(std::vector<Field>& fields, const TicketColumns& tickets) : numWords((fields.size() + 63) / 64) {
+    for (auto& field : fields) {
+      this->fields.push_back(&field);
+    }
+    this->candidates = std::vector(fields.size(), allFields(fields.size()));
+    for (size_t i = 0; i < tickets.getNumColumns(); ++i) {
+      this->myTicket.push_back(tickets.getValue(tickets.getNumTickets() - 1, i));
+    }
+
+    // Remove options where values out of range
+    this->removeImpossible(tickets);
+    this->propagate();
+  }
+
+  // Candidates already filtered by the values on the tickets
+  Solver(std::vector<Field>& fields, std::vector<std::vector<uint64_t>> candidates, std::vector<uint32_t> myTicket)
+      : candidates(std::move(candidates)), myTicket(std::move(myTicket)), numWords((fields.size() + 63) / 64) {
+    for (auto& field : fields) {
+      this->fields.push_back(&field);
+    }
+    this->propagate();
+  }
+
+  std::vector<std::vector<Field*>> getPossibilities() const {
+    std::vector<std::vector<Field*>> possibilities(this->candidates.size());
+    for (size_t i = 0; i < this->candidates.size(); ++i) {
+      for (size_t f = 0; f < this->fields.size(); ++f) {
+        if (this->hasCandidate(i, f)) possibilities[i].push_back(this->fields[f]);
       }
-      for (int i = unsuitableCandidatesIdxs.size() - 1; i >= 0; --i) {
-        // Start from back because removing elements from the vector!
-        unsigned int candidateIdx = unsuitableCandidatesIdxs[i];
-        fieldCandidates.erase(fieldCandidates.begin() + candidateIdx);
+    }
+    return possibilities;
+  }
+
+  void removeImpossible(const TicketColumns& tickets) {
+    for (size_t position = 0; position < this->candidates.size(); ++position) {
+      for (size_t f = 0; f < this->fields.size(); ++f) {
+        if (!tickets.allValid(position, *this->fields[f])) {
+          this->candidates[position][f / 64] &= ~(uint64_t(1) << (f % 64));
+        }
       }
     }
   }
 
   bool fixPositionsWithOneOption() {
     bool change = false;
-    for (int i = 0; i < this->possibilities.size(); ++i) {
-      if (this->fixed[i]) continue;
-      auto& possibility = this->possibilities[i];
-      if (possibility.size() == 1) {
-        this->fixed[i] = true;
+    for (size_t i = 0; i < this->candidates.size(); ++i) {
+      if (!this->fixed[i] && this->countCandidates(i) == 1) {
+        this->fix(i, this->firstCandidate(i));
         change = true;
       }
     }
@@ -127,53 +242,37 @@ class Solver {
   }
 
   bool fixFieldsWithOnlyOneOption() {
-    bool change = false;
-    for (auto field : this->fields) {
-      int count = 0;
-      int foundAt = -1;
-      for (int i = 0; i < this->possibilities.size(); ++i) {
-        auto& pos = this->possibilities[i];
-        auto search = std::find(pos.begin(), pos.end(), field);
-        if (search != pos.end()) {
-          ++count;
-          foundAt = i;
-          if (count > 1) break;
-        }
-      }
-      if (count == 1 && !this->fixed[foundAt]) {
-        this->fixed[foundAt] = true;
-        this->possibilities[foundAt].clear();
-        this->possibilities[foundAt].push_back(field);
-        change = true;
+    // Fields that are candidates at exactly one position: in `once` but not in `twice`
+    std::vector<uint64_t> once(this->numWords, 0);
+    std::vector<uint64_t> twice(this->numWords, 0);
+    for (auto& position : this->candidates) {
+      for (size_t w = 0; w < this->numWords; ++w) {
+        twice[w] |= once[w] & position[w];
+        once[w] |= position[w];
       }
     }
-    return change;
-  }
 
-  void removeFixed() {
-    for (int i = 0; i < this->fixed.size(); ++i) {
-      if (this->fixed[i]) {
-        auto field = this->possibilities[i][0];
-        for (int j = 0; j < this->possibilities.size(); ++j) {
-          if (!this->fixed[j]) {
-            auto& pos = this->possibilities[j];
-            auto search = std::find(pos.begin(), pos.end(), field);
-            if (search != pos.end()) {
-              pos.erase(search);
-            }
-          }
+    bool change = false;
+    for (size_t i = 0; i < this->candidates.size(); ++i) {
+      if (this->fixed[i]) continue;
+      for (size_t w = 0; w < this->numWords; ++w) {
+        uint64_t unique = this->candidates[i][w] & once[w] & ~twice[w];
+        if (unique != 0) {
+          this->fix(i, w * 64 + __builtin_ctzll(unique));
+          change = true;
+          break;
         }
       }
     }
+    return change;
   }
 
   unsigned long calculateStar2() {
-    Ticket myTicket = this->tickets[this->tickets.size() - 1];
     unsigned long result = 1;
-    for (int i = 0; i < this->possibilities.size(); ++i) {
-      auto& f = *this->possibilities[i][0];
+    for (size_t i = 0; i < this->candidates.size(); ++i) {
+      auto& f = *this->fields[this->firstCandidate(i)];
       if (f.getName()[0] == 'd' && f.getName()[1] == 'e') {
-        result *= static_cast<unsigned long>(myTicket.getValue(i));
+        result *= static_cast<unsigned long>(this->myTicket[i]);
       }
     }
     return result;
@@ -197,6 +296,27 @@ std::ostream& operator<<(std::ostream& output, const Solver& s) {
  * Parse input
  */
 
+// Parse a line like "departure location: 49-258 or 268-954"
+Field parseField(const std::string& line) {
+  std::vector<std::string> splitValues;
+  // Split in two parts
+  boost::split(splitValues, line, boost::is_any_of(":"));
+  if (splitValues.size() != 2) {
+    std::cerr << "Invalid field: " << line << std::endl;
+    std::terminate();
+  }
+  std::string fieldName = splitValues[0];
+
+  // Split second part further
+  boost::split(splitValues, splitValues[1], boost::is_any_of(" -"));
+  if (splitValues.size() != 6) {
+    std::cerr << "Invalid field: " << line << std::endl;
+    std::terminate();
+  }
+  return Field(fieldName, std::stoul(splitValues[1]), std::stoul(splitValues[2]), std::stoul(splitValues[4]),
+               std::stoul(splitValues[5]));
+}
+
 std::tuple<std::vector<Field>, Ticket, std::vector<Ticket>> parseInput(const std::string& filename) {
   std::fstream file;
   file.open(filename, std::ios::in);
@@ -207,17 +327,8 @@ std::tuple<std::vector<Field>, Ticket, std::vector<Ticket>> parseInput(const std
 
     // Read fields
     std::vector<Field> fields;
-    std::string fieldName;
     while (std::getline(file, line) && line.size() > 0) {
-      // Split in two parts
-      boost::split(splitValues, line, boost::is_any_of(":"));
-      fieldName = splitValues[0];
-
-      // Split second part further
-      boost::split(splitValues, splitValues[1], boost::is_any_of(" -"));
-      fields.push_back(Field(fieldName, std::stoul(splitValues[1]), std::stoul(splitValues[2]),
-                             std::stoul(splitValues[4]), std::stoul(splitValues[5])));
-      splitValues.clear();
+      fields.push_back(parseField(line));
     }
 
     // Read my ticket
@@ -232,7 +343,6 @@ std::tuple<std::vector<Field>, Ticket, std::vector<Ticket>> parseInput(const std
     std::getline(file, line);  // Read "nearby ticket"
     while (std::getline(file, line) && line.size() > 0) {
       boost::split(splitValues, line, boost::is_any_of(","));
-      fieldName = splitValues[0];
       nearbyTickets.push_back(Ticket(splitValues));
       splitValues.clear();
     }
@@ -249,44 +359,69 @@ std::tuple<std::vector<Field>, Ticket, std::vector<Ticket>> parseInput(const std
  * Solve star 1
  */
 
-unsigned int getMaxPossibleValue(const std::vector<Field>& fields) {
-  unsigned int max = 0;
-  for (auto& field : fields) {
-    unsigned int endRange2 = field.getRange2().second;
-    if (endRange2 > max) max = endRange2;
-  }
-  return max;
-}
+// Values that are valid for at least one field: the field ranges merged into sorted, disjoint intervals.
+// If the intervals span a small enough domain, lookups use a bitmap instead of a binary search.
+class ValidityIndex {
+ private:
+  static constexpr uint64_t MAX_BITMAP_SIZE = uint64_t(1) << 20;
+
+  std::vector<std::pair<uint64_t, uint64_t>> intervals;  // Inclusive bounds
+  std::vector<uint64_t> bitmap;                          // Bit v is set if v is valid
+  bool useBitmap;
+
+ public:
+  ValidityIndex(const std::vector<Field>& fields) : useBitmap(false) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (auto& field : fields) {
+      ranges.push_back(field.getRange1());
+      ranges.push_back(field.getRange2());
+    }
+    std::sort(ranges.begin(), ranges.end());
+    for (auto& range : ranges) {
+      if (!this->intervals.empty() && range.first <= this->intervals.back().second + 1) {
+        this->intervals.back().second = std::max(this->intervals.back().second, range.second);
+      } else {
+        this->intervals.push_back(range);
+      }
+    }
 
-std::vector<bool> mergeValidRanges(const std::vector<Field>& fields) {
-  unsigned int maxValue = getMaxPossibleValue(fields);
-  std::vector<bool> validValues(maxValue + 1, false);
-  for (auto& field : fields) {
-    std::pair range1 = field.getRange1();
-    for (unsigned int i = range1.first; i <= range1.second; ++i) {
-      validValues[i] = true;
+    if (!this->intervals.empty() && this->intervals.back().second < MAX_BITMAP_SIZE) {
+      this->useBitmap = true;
+      this->bitmap.assign(this->intervals.back().second / 64 + 1, 0);
+      for (auto& interval : this->intervals) {
+        for (uint64_t v = interval.first; v <= interval.second; ++v) {
+          this->bitmap[v / 64] |= uint64_t(1) << (v % 64);
+        }
+      }
     }
-    std::pair range2 = field.getRange2();
-    for (unsigned int i = range2.first; i <= range2.second; ++i) {
-      validValues[i] = true;
+  }
+
+  bool contains(uint64_t value) const {
+    if (this->useBitmap) {
+      return value / 64 < this->bitmap.size() && ((this->bitmap[value / 64] >> (value % 64)) & 1);
     }
+    // First interval that starts after value, the one before it is the only candidate
+    auto it = std::upper_bound(this->intervals.begin(), this->intervals.end(), std::pair(value, UINT64_MAX));
+    return it != this->intervals.begin() && value <= std::prev(it)->second;
   }
-  return validValues;
-}
+};
 
-std::vector<Ticket> part1(const std::vector<Field>& fields, const std::vector<Ticket>& nearbyTickets) {
-  std::vector validValues = mergeValidRanges(fields);
-  std::vector<Ticket> validTickets;
+// Returns 1 for each valid ticket and 0 for the others
+std::vector<uint8_t> part1(const std::vector<Field>& fields, const TicketColumns& nearbyTickets) {
+  const size_t numTickets = nearbyTickets.getNumTickets();
+  std::vector<uint8_t> validTickets(numTickets, 1);
+  std::vector<uint8_t> validInColumn(numTickets);
   unsigned int sum = 0;
-  for (auto& ticket : nearbyTickets) {
-    bool errorFound = false;
-    for (auto val : ticket.getValues()) {
-      if (val >= validValues.size() or !validValues[val]) {
-        sum += val;
-        errorFound = true;
-      }
+  for (size_t i = 0; i < nearbyTickets.getNumColumns(); ++i) {
+    std::fill(validInColumn.begin(), validInColumn.end(), 0);
+    for (auto& field : fields) {
+      nearbyTickets.markValid(i, field, validInColumn);
+    }
+    const std::vector<uint32_t>& values = nearbyTickets.getColumn(i);
+    for (size_t t = 0; t < numTickets; ++t) {
+      sum += values[t] * (1 - validInColumn[t]);
+      validTickets[t] &= validInColumn[t];
     }
-    if (!errorFound) validTickets.push_back(ticket);
   }
   std::cout << sum << std::endl;
   return validTickets;
@@ -295,37 +430,112 @@ std::vector<Ticket> part1(const std::vector<Field>& fields, const std::vector<Ti
 /*
  * Solve star 2
  */
-std::vector<Ticket> getValidTickets(const std::vector<Field>& fields, const std::vector<Ticket>& tickets) {
-  std::vector<Ticket> validTickets;
-  std::vector validValues = mergeValidRanges(fields);
-  for (auto& ticket : tickets) {
-    bool errorFound = false;
-    for (auto val : ticket.getValues()) {
-      if (val >= validValues.size() or !validValues[val]) {
-        errorFound = true;
-      }
+void part2(std::vector<Field>& fields, const TicketColumns& tickets) {
+  Solver solver(fields, tickets);
+  // std::cout << solver;
+  std::cout << solver.calculateStar2() << std::endl;
+}
+
+/*
+ * Solve both stars while reading the input
+ */
+
+// Parse comma separated values into values, reusing its storage
+void parseTicketValues(const std::string& line, std::vector<uint32_t>& values) {
+  values.clear();
+  uint32_t value = 0;
+  for (char c : line) {
+    if (c == ',') {
+      values.push_back(value);
+      value = 0;
+    } else if (!isdigit(c)) {
+      std::cerr << "Invalid character in ticket: " << line << std::endl;
+      std::terminate();
+    } else if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, c - '0', &value)) {
+      std::cerr << "Number doesn't fit in 32 bits: " << line << std::endl;
+      std::terminate();
     }
-    if (!errorFound) validTickets.push_back(ticket);
   }
-  return validTickets;
+  values.push_back(value);
 }
 
-void part2(std::vector<Field>& fields, const std::vector<Ticket>& tickets) {
-  Solver solver(fields, tickets);
-  // std::cout << solver;
+// Every nearby ticket is checked and narrows the candidates as soon as it is read, then dropped.
+// Memory does not depend on the number of nearby tickets.
+void solveStreaming(const std::string& filename) {
+  std::fstream file;
+  file.open(filename, std::ios::in);
+  if (!file.is_open()) {
+    std::cerr << "Can't open file " << filename << std::endl;
+    std::cerr << "PWD: " << std::filesystem::current_path() << std::endl;
+    std::terminate();
+  }
+
+  std::string line;
+  std::vector<Field> fields;
+  while (std::getline(file, line) && line.size() > 0) {
+    fields.push_back(parseField(line));
+  }
+  const ValidityIndex validValues(fields);
+
+  std::vector<uint32_t> myTicket;
+  std::getline(file, line);  // Read "your ticket"
+  std::getline(file, line);  // Read values on my ticket
+  parseTicketValues(line, myTicket);
+
+  // candidates[i] is a bitset (over field indices) of fields that can be at position i
+  std::vector<std::vector<uint64_t>> candidates(myTicket.size(), Solver::allFields(fields.size()));
+  std::vector<uint32_t> values;
+  unsigned int sum = 0;
+  std::getline(file, line);  // Read empty line
+  std::getline(file, line);  // Read "nearby ticket"
+  while (std::getline(file, line) && line.size() > 0) {
+    parseTicketValues(line, values);
+    bool valid = values.size() == myTicket.size();
+    for (uint32_t value : values) {
+      if (!validValues.contains(value)) {
+        sum += value;
+        valid = false;
+      }
+    }
+    if (!valid) continue;
+
+    for (size_t i = 0; i < values.size(); ++i) {
+      for (size_t f = 0; f < fields.size(); ++f) {
+        if (!fields[f].isValueValid(values[i])) candidates[i][f / 64] &= ~(uint64_t(1) << (f % 64));
+      }
+    }
+  }
+  std::cout << sum << std::endl;
+
+  // My ticket is valid too
+  for (size_t i = 0; i < myTicket.size(); ++i) {
+    for (size_t f = 0; f < fields.size(); ++f) {
+      if (!fields[f].isValueValid(myTicket[i])) candidates[i][f / 64] &= ~(uint64_t(1) << (f % 64));
+    }
+  }
+
+  Solver solver(fields, std::move(candidates), std::move(myTicket));
   std::cout << solver.calculateStar2() << std::endl;
 }
 
 int main() {
   const std::string filename = "../day-16/input.txt";
+  const bool streaming = true;
+
+  if (streaming) {
+    solveStreaming(filename);
+    return 0;
+  }
+
   auto input = parseInput(filename);
 
   std::vector<Field> fields = std::get<0>(input);
   Ticket myTicket = std::get<1>(input);
   std::vector<Ticket> nearbyTickets = std::get<2>(input);
 
-  std::vector<Ticket> validTickets = part1(fields, nearbyTickets);
-  validTickets.push_back(myTicket);
+  TicketColumns nearbyColumns(nearbyTickets);
+  TicketColumns validTickets = nearbyColumns.filter(part1(fields, nearbyColumns));
+  validTickets.add(myTicket);
 
   part2(fields, validTickets);
 
@@ -1,3 +1,7 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "aoclib.hpp"
 
 enum class Operator { PLUS = '+', MULT = '*' };
@@ -83,6 +87,135 @@ std::pair<std::unique_ptr<Expression>, int> parseExpression(std::string &line, i
   return std::pair(std::move(root), i);
 }
 
+// Flat postfix program: PUSH puts a value on the stack, operators replace the top two values with the result
+struct BytecodeOp {
+  enum Kind : uint8_t { PUSH, PLUS, MULT };
+  Kind kind;
+  uint64_t value;
+};
+
+BytecodeOp operatorToBytecode(char op) { return {op == '+' ? BytecodeOp::PLUS : BytecodeOp::MULT, 0}; }
+
+struct OperatorInfo {
+  int precedence;  // Higher binds tighter
+  bool rightAssociative;
+};
+
+// Precedence and associativity of + and *, decided at runtime
+struct OperatorTable {
+  OperatorInfo plus;
+  OperatorInfo mult;
+
+  const OperatorInfo &get(char op) const { return op == '+' ? this->plus : this->mult; }
+
+  static OperatorTable samePrecedence() { return {{1, false}, {1, false}}; }
+  static OperatorTable additionFirst() { return {{2, false}, {1, false}}; }
+};
+
+// Precedence climbing: compiles the line in one left-to-right pass
+class ExpressionCompiler {
+ private:
+  const OperatorTable &table;
+  const std::string &line;
+  std::vector<BytecodeOp> &code;
+  size_t pos;
+
+  char peek() {
+    while (this->pos < this->line.size() && this->line[this->pos] == ' ') ++this->pos;
+    return this->pos < this->line.size() ? this->line[this->pos] : '\0';
+  }
+
+  void compilePrimary() {
+    char token = this->peek();
+    if (isdigit(token)) {
+      uint64_t value = 0;
+      while (this->pos < this->line.size() && isdigit(this->line[this->pos])) {
+        if (__builtin_mul_overflow(value, 10, &value) ||
+            __builtin_add_overflow(value, this->line[this->pos] - '0', &value)) {
+          std::cerr << "Number at position " << this->pos << " doesn't fit in 64 bits" << std::endl;
+          std::terminate();
+        }
+        ++this->pos;
+      }
+      this->code.push_back({BytecodeOp::PUSH, value});
+    } else if (token == '(') {
+      ++this->pos;
+      this->compile(0);
+      if (this->peek() != ')') {
+        std::cerr << "Missing ) at position " << this->pos << std::endl;
+        std::terminate();
+      }
+      ++this->pos;
+    } else if (token == '\0') {
+      std::cerr << "Unexpected end of expression " << this->line << std::endl;
+      std::terminate();
+    } else {
+      std::cerr << "Invalid token " << token << std::endl;
+      std::terminate();
+    }
+  }
+
+ public:
+  ExpressionCompiler(const OperatorTable &table, const std::string &line, std::vector<BytecodeOp> &code)
+      : table(table), line(line), code(code), pos(0) {}
+
+  // Compiles operands and all following operators that bind at least as tight as minPrecedence
+  void compile(int minPrecedence) {
+    this->compilePrimary();
+    while (true) {
+      char op = this->peek();
+      if (op != '+' && op != '*') break;
+      const OperatorInfo &info = this->table.get(op);
+      if (info.precedence < minPrecedence) break;
+      ++this->pos;
+      this->compile(info.rightAssociative ? info.precedence : info.precedence + 1);
+      this->code.push_back(operatorToBytecode(op));
+    }
+  }
+
+  // Compiles the whole line, nothing may follow the expression
+  void compileLine() {
+    this->compile(0);
+    char token = this->peek();
+    if (token == ')') {
+      std::cerr << "Unmatched ) at position " << this->pos << std::endl;
+      std::terminate();
+    } else if (token != '\0') {
+      std::cerr << "Unexpected token " << token << " at position " << this->pos << std::endl;
+      std::terminate();
+    }
+  }
+};
+
+// The code buffer is passed in so it can be reused between lines
+void compileExpression(const std::string &line, const OperatorTable &table, std::vector<BytecodeOp> &code) {
+  code.clear();
+  ExpressionCompiler compiler(table, line, code);
+  compiler.compileLine();
+}
+
+// Returns false if any intermediate result doesn't fit in 64 bits
+bool evalBytecode(const std::vector<BytecodeOp> &code, std::vector<uint64_t> &stack, uint64_t &result) {
+  stack.clear();
+  for (const BytecodeOp &op : code) {
+    if (op.kind == BytecodeOp::PUSH) {
+      stack.push_back(op.value);
+      continue;
+    }
+    uint64_t right = stack.back();
+    stack.pop_back();
+    bool overflow;
+    if (op.kind == BytecodeOp::PLUS) {
+      overflow = __builtin_add_overflow(stack.back(), right, &stack.back());
+    } else {
+      overflow = __builtin_mul_overflow(stack.back(), right, &stack.back());
+    }
+    if (overflow) return false;
+  }
+  result = stack.back();
+  return true;
+}
+
 // Insert parentheses around expressions with +
 std::string insertParantheses(std::string &line) {
   std::string newLine = line;
@@ -138,8 +271,169 @@ void solve(std::vector<std::unique_ptr<Expression>> &input) {
   std::cout << sum << std::endl;
 }
 
+// std::to_string has no overload for 128-bit integers
+std::string to_string(unsigned __int128 value) {
+  std::string out;
+  do {
+    out += static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  std::reverse(out.begin(), out.end());
+  return out;
+}
+
+// Same as solve, but evaluates each line with the bytecode evaluator (no trees are built).
+// Every expression is checked for 64-bit overflow. With wideSum, the results are summed in 128 bits,
+// otherwise the sum has to fit in 64 bits as well.
+void solveBytecode(std::vector<std::string> &lines, const OperatorTable &table, bool wideSum = false) {
+  std::vector<BytecodeOp> code;
+  std::vector<uint64_t> stack;
+  uint64_t sum = 0;
+  unsigned __int128 wide = 0;
+  for (auto &line : lines) {
+    compileExpression(line, table, code);
+    uint64_t result;
+    if (!evalBytecode(code, stack, result)) {
+      std::cerr << "Overflow in expression " << line << std::endl;
+      std::terminate();
+    }
+    if (wideSum) {
+      wide += result;
+    } else if (__builtin_add_overflow(sum, result, &sum)) {
+      std::cerr << "Sum doesn't fit in 64 bits" << std::endl;
+      std::terminate();
+    }
+  }
+  std::cout << (wideSum ? to_string(wide) : std::to_string(sum)) << std::endl;
+}
+
+// Bounded queue of line batches between the thread that reads the file and the workers
+class BatchQueue {
+ private:
+  std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+  std::deque<std::vector<std::string>> batches;
+  const size_t capacity;
+  bool closed;
+
+ public:
+  BatchQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+  void push(std::vector<std::string> batch) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->notFull.wait(lock, [this]() { return this->batches.size() < this->capacity; });
+    this->batches.push_back(std::move(batch));
+    this->notEmpty.notify_one();
+  }
+
+  // Returns false once the queue is closed and empty
+  bool pop(std::vector<std::string> &batch) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->notEmpty.wait(lock, [this]() { return !this->batches.empty() || this->closed; });
+    if (this->batches.empty()) return false;
+    batch = std::move(this->batches.front());
+    this->batches.pop_front();
+    this->notFull.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->closed = true;
+    this->notEmpty.notify_all();
+  }
+};
+
+// Reads the file once and evaluates every line with each of the operator tables while reading, so only
+// a few batches of lines are in memory at any time. Each worker keeps its own buffers and partial sums
+// (in 128 bits), which are added up at the end.
+void solveStreaming(const std::string &filename, const std::vector<OperatorTable> &tables, unsigned int numThreads,
+                    bool wideSum = false) {
+  std::fstream file;
+  file.open(filename, std::ios::in);
+  if (!file.is_open()) {
+    std::cerr << "Can't open file " << filename << std::endl;
+    std::cerr << "PWD: " << std::filesystem::current_path() << std::endl;
+    std::terminate();
+  }
+
+  const size_t batchSize = 1024;
+  numThreads = std::max(1u, numThreads);
+  BatchQueue queue(2 * numThreads);
+  std::vector<std::vector<unsigned __int128>> partialSums(numThreads, std::vector<unsigned __int128>(tables.size()));
+
+  auto worker = [&queue, &tables, &partialSums](size_t id) {
+    std::vector<BytecodeOp> code;
+    std::vector<uint64_t> stack;
+    std::vector<std::string> batch;
+    while (queue.pop(batch)) {
+      for (auto &line : batch) {
+        for (size_t t = 0; t < tables.size(); ++t) {
+          compileExpression(line, tables[t], code);
+          uint64_t result;
+          if (!evalBytecode(code, stack, result)) {
+            std::cerr << "Overflow in expression " << line << std::endl;
+            std::terminate();
+          }
+          partialSums[id][t] += result;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t id = 0; id < numThreads; ++id) {
+    threads.push_back(std::thread(worker, id));
+  }
+
+  std::vector<std::string> batch;
+  std::string line;
+  while (std::getline(file, line)) {
+    batch.push_back(line);
+    if (batch.size() == batchSize) {
+      queue.push(std::move(batch));
+      batch = std::vector<std::string>();
+    }
+  }
+  if (!batch.empty()) queue.push(std::move(batch));
+  queue.close();
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (size_t t = 0; t < tables.size(); ++t) {
+    unsigned __int128 sum = 0;
+    for (auto &partial : partialSums) {
+      sum += partial[t];
+    }
+    if (!wideSum && sum > UINT64_MAX) {
+      std::cerr << "Sum doesn't fit in 64 bits" << std::endl;
+      std::terminate();
+    }
+    std::cout << to_string(sum) << std::endl;
+  }
+}
+
+enum class Evaluator { TREE, BYTECODE, STREAMING };
+
 int main() {
   const std::string filename = "../day-18/input.txt";
+  const Evaluator evaluator = Evaluator::STREAMING;
+
+  if (evaluator == Evaluator::STREAMING) {
+    std::vector<OperatorTable> tables = {OperatorTable::samePrecedence(), OperatorTable::additionFirst()};
+    solveStreaming(filename, tables, std::thread::hardware_concurrency());
+    return 0;
+  }
+
+  if (evaluator == Evaluator::BYTECODE) {
+    auto lines = aoc::readStringInput(filename);
+    solveBytecode(lines, OperatorTable::samePrecedence());
+    solveBytecode(lines, OperatorTable::additionFirst());
+    return 0;
+  }
 
   // Part 1
   auto input = aoc::readParseInput(filename, parseExpressionWrapper);
@@ -1,156 +1,492 @@
-#include "aoclib.hpp"
-
-struct ReturnObject {
-  bool success;
-  std::vector<size_t> newStarts;  // Next positions where to start parsing
-};
+#include <future>
+#include <map>
 
-class Rule {
- protected:
-  size_t ruleIdx;
-  Rule(size_t idx) : ruleIdx(idx) {}
+#include "aoclib.hpp"
 
+// All rules stored in three flat arrays; rules refer to each other by index. Rule r is rules[r]. A rule
+// that is not a letter has numSequences alternatives, and alternative a is the sequence of rule indices
+// refs[sequences[firstSequence + a]] up to refs[sequences[firstSequence + a + 1]].
+class Grammar {
  public:
-  virtual ReturnObject parse(std::string& message, size_t position) const = 0;
-  virtual std::string str() const = 0;
-  size_t getIdx() const { return this->ruleIdx; }
-  virtual ~Rule() = default;
-};
+  enum Kind : uint8_t { MISSING, LETTER, CHOICE };
+
+  struct RuleNode {
+    Kind kind;
+    char letter;
+    uint32_t firstSequence;
+    uint32_t numSequences;
+  };
+
+  struct Sequence {
+    const uint32_t* first;
+    const uint32_t* last;
+    const uint32_t* begin() const { return first; }
+    const uint32_t* end() const { return last; }
+    size_t size() const { return last - first; }
+    uint32_t operator[](size_t i) const { return first[i]; }
+  };
 
-class Letter : public Rule {
  private:
-  char letter;
+  std::vector<RuleNode> rules;
+  std::vector<uint32_t> sequences;  // Offsets into refs, the last one marks the end of refs
+  std::vector<uint32_t> refs;
+
+  static uint32_t readNumber(const std::string& line, size_t& pos) {
+    uint32_t value = 0;
+    while (pos < line.size() && isdigit(line[pos])) {
+      value = value * 10 + (line[pos] - '0');
+      ++pos;
+    }
+    return value;
+  }
 
  public:
-  Letter(size_t idx, char letter) : Rule(idx), letter(letter) {}
-  ReturnObject parse(std::string& message, size_t position) const override {
-    if (message[position] == this->letter) {
-      return {true, {position + 1}};
+  // FORMAT: 0: 4 1 5 | 2 3
+  //         4: "a"
+  Grammar(std::vector<std::string>& input) {
+    for (auto& line : input) {
+      size_t pos = 0;
+      const uint32_t idx = readNumber(line, pos);
+      if (idx >= this->rules.size()) {
+        this->rules.resize(idx + 1, {MISSING, '\0', 0, 0});
+      }
+      RuleNode& rule = this->rules[idx];
+
+      const size_t quote = line.find('"', pos);
+      if (quote != std::string::npos) {
+        rule = {LETTER, line[quote + 1], 0, 0};
+        continue;
+      }
+
+      rule = {CHOICE, '\0', static_cast<uint32_t>(this->sequences.size()), 1};
+      this->sequences.push_back(this->refs.size());
+      while (pos < line.size()) {
+        if (isdigit(line[pos])) {
+          this->refs.push_back(readNumber(line, pos));
+        } else {
+          if (line[pos] == '|') {
+            this->sequences.push_back(this->refs.size());
+            ++rule.numSequences;
+          }
+          ++pos;
+        }
+      }
     }
-    return {false, {}};
+    this->sequences.push_back(this->refs.size());
+  }
+
+  size_t getNumRules() const { return this->rules.size(); }
+  bool isLetter(uint32_t rule) const { return this->rules[rule].kind == LETTER; }
+  char getLetter(uint32_t rule) const { return this->rules[rule].letter; }
+  uint32_t getNumAlternatives(uint32_t rule) const { return this->rules[rule].numSequences; }
+  Sequence getAlternative(uint32_t rule, uint32_t alt) const {
+    const uint32_t s = this->rules[rule].firstSequence + alt;
+    return {this->refs.data() + this->sequences[s], this->refs.data() + this->sequences[s + 1]};
   }
-  std::string str() const override { return std::to_string(this->ruleIdx) + ": \"" + this->letter + "\""; }
 };
 
-class CompositeRule : public Rule {
+// Tries all alternatives and collects all positions where a rule can end
+class BacktrackingParser {
  private:
-  std::vector<std::shared_ptr<Rule>> subrules;
+  const Grammar& grammar;
+  const uint32_t start;
 
- public:
-  CompositeRule(size_t idx, std::vector<std::shared_ptr<Rule>> subrules) : Rule(idx), subrules(subrules) {}
-
-  ReturnObject parse(std::string& message, size_t position) const override {
-    if (position >= message.size()) return {false, {}};
-
-    std::vector<size_t> possibleStarts = {position};
-    for (auto& rule : this->subrules) {
-      std::vector<size_t> possibleNextStarts;
-      for (auto& pos : possibleStarts) {
-        auto [success, positions] = rule->parse(message, pos);
-        if (success) {
-          possibleNextStarts.insert(possibleNextStarts.end(), positions.begin(), positions.end());
+  void parse(const std::string& message, uint32_t rule, size_t position, std::vector<size_t>& ends) const {
+    if (position >= message.size()) return;
+
+    if (this->grammar.isLetter(rule)) {
+      if (message[position] == this->grammar.getLetter(rule)) ends.push_back(position + 1);
+      return;
+    }
+
+    for (uint32_t a = 0; a < this->grammar.getNumAlternatives(rule); ++a) {
+      std::vector<size_t> possibleStarts = {position};
+      for (uint32_t sub : this->grammar.getAlternative(rule, a)) {
+        std::vector<size_t> possibleNextStarts;
+        for (auto& pos : possibleStarts) {
+          this->parse(message, sub, pos, possibleNextStarts);
         }
+        possibleStarts.swap(possibleNextStarts);
       }
-      possibleStarts = possibleNextStarts;
+      ends.insert(ends.end(), possibleStarts.begin(), possibleStarts.end());
     }
-
-    return {possibleStarts.size() > 0, possibleStarts};
   }
 
-  std::string str() const {
-    std::string subrules = "";
-    for (auto& rule : this->subrules) {
-      subrules += std::to_string(rule->getIdx()) + " ";
-    }
-    return std::to_string(this->ruleIdx) + ": " + subrules;
+ public:
+  BacktrackingParser(const Grammar& grammar, uint32_t start) : grammar(grammar), start(start) {}
+
+  bool matches(const std::string& message) const {
+    std::vector<size_t> ends;
+    this->parse(message, this->start, 0, ends);
+    return std::find(ends.begin(), ends.end(), message.size()) != ends.end();
   }
 };
 
-class OrRule : public Rule {
+// Deterministic automaton compiled from a non-recursive grammar (whose language is therefore regular).
+// Matching a message is a walk through a flat transition table.
+class Dfa {
  private:
-  std::vector<std::shared_ptr<Rule>> options;
+  static constexpr uint32_t DEAD = 0;
+  static constexpr uint32_t START = 1;
+  static constexpr uint8_t NO_SYMBOL = 0xFF;
+
+  // A configuration is a stack of (rule, alternative, position) frames of a parse that waits for a letter.
+  // The empty stack means that the whole start rule was matched.
+  using Configuration = std::vector<uint32_t>;
+  using StateSet = std::set<Configuration>;
+
+  size_t numSymbols;
+  std::array<uint8_t, 256> symbolOf;
+  std::vector<char> symbols;
+  std::vector<uint32_t> transitions;  // numStates * numSymbols
+  std::vector<bool> accepting;
+
+  static void closure(const Grammar& g, Configuration config, StateSet& out) {
+    if (config.empty()) {
+      out.insert(config);
+      return;
+    }
+    const size_t n = config.size();
+    const uint32_t rule = config[n - 3];
+    const uint32_t alt = config[n - 2];
+    const uint32_t pos = config[n - 1];
+    const size_t length = g.isLetter(rule) ? 1 : g.getAlternative(rule, alt).size();
+
+    if (pos < length && g.isLetter(rule)) {
+      out.insert(config);  // Waits for a letter
+    } else if (pos == length) {
+      // Rule completed, continue with the parent
+      config.resize(n - 3);
+      if (!config.empty()) ++config.back();
+      closure(g, config, out);
+    } else {
+      const uint32_t sub = g.getAlternative(rule, alt)[pos];
+      for (size_t f = 0; f < n; f += 3) {
+        if (config[f] == sub) {
+          std::cerr << "Rule " << sub << " is recursive" << std::endl;
+          std::terminate();
+        }
+      }
+      const size_t numAlternatives = g.isLetter(sub) ? 1 : g.getNumAlternatives(sub);
+      for (uint32_t a = 0; a < numAlternatives; ++a) {
+        Configuration next = config;
+        next.insert(next.end(), {sub, a, 0});
+        closure(g, next, out);
+      }
+    }
+  }
+
+  static StateSet step(const Grammar& g, const StateSet& state, char c) {
+    StateSet next;
+    for (const Configuration& config : state) {
+      if (config.empty() || g.getLetter(config[config.size() - 3]) != c) continue;
+      Configuration advanced = config;
+      ++advanced.back();
+      closure(g, advanced, next);
+    }
+    return next;
+  }
 
  public:
-  OrRule(size_t idx) : Rule(idx) {}
+  // Builds the automaton with the subset construction
+  Dfa(const Grammar& g, uint32_t start) {
+    this->symbolOf.fill(NO_SYMBOL);
+    for (uint32_t r = 0; r < g.getNumRules(); ++r) {
+      const char c = g.getLetter(r);
+      if (g.isLetter(r) && this->symbolOf[static_cast<unsigned char>(c)] == NO_SYMBOL) {
+        this->symbolOf[static_cast<unsigned char>(c)] = this->symbols.size();
+        this->symbols.push_back(c);
+      }
+    }
+    this->numSymbols = this->symbols.size();
+
+    std::map<StateSet, uint32_t> stateIds;
+    std::vector<StateSet> states(2);
+    stateIds[states[DEAD]] = DEAD;
+    const size_t numAlternatives = g.isLetter(start) ? 1 : g.getNumAlternatives(start);
+    for (uint32_t a = 0; a < numAlternatives; ++a) {
+      closure(g, {start, a, 0}, states[START]);
+    }
+    stateIds[states[START]] = START;
+
+    for (uint32_t id = 0; id < states.size(); ++id) {
+      this->accepting.push_back(states[id].count({}) > 0);
+      for (char c : this->symbols) {
+        StateSet next = step(g, states[id], c);
+        auto [it, inserted] = stateIds.insert({next, states.size()});
+        if (inserted) states.push_back(next);
+        this->transitions.push_back(it->second);
+      }
+    }
+  }
 
-  void init(std::vector<std::shared_ptr<Rule>> options) { this->options = options; }
+  size_t getNumStates() const { return this->accepting.size(); }
 
-  ReturnObject parse(std::string& message, size_t position) const override {
-    if (position >= message.size()) return {false, {}};
+  bool matches(const std::string& message) const {
+    uint32_t state = START;
+    for (char c : message) {
+      const uint8_t symbol = this->symbolOf[static_cast<unsigned char>(c)];
+      if (symbol == NO_SYMBOL) return false;
+      state = this->transitions[state * this->numSymbols + symbol];
+      if (state == DEAD) return false;
+    }
+    return this->accepting[state];
+  }
+};
 
-    std::vector<size_t> possiblePositions;
-    for (auto& option : this->options) {
-      auto [success, newStarts] = option->parse(message, position);
-      if (success) possiblePositions.insert(possiblePositions.end(), newStarts.begin(), newStarts.end());
+// Earley parser that works for any set of rules (including recursive ones) in at most cubic time.
+// The chart is one flat array of items, which is reused for all messages.
+class EarleyParser {
+ private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  struct Item {
+    uint32_t rule;
+    uint32_t alt;
+    uint32_t dot;
+    uint32_t origin;  // Index of the set in which the item was predicted
+    bool operator==(const Item& other) const {
+      return rule == other.rule && alt == other.alt && dot == other.dot && origin == other.origin;
     }
-    if (possiblePositions.size() > 0) {
-      return {true, possiblePositions};
+  };
+
+  struct ItemHash {
+    size_t operator()(const Item& item) const {
+      uint64_t h = (uint64_t(item.rule) << 32 | item.alt) * 0x9E3779B97F4A7C15ULL;
+      return h ^ ((uint64_t(item.dot) << 32 | item.origin) + (h >> 29));
     }
-    return {false, {}};
+  };
+
+  const Grammar& grammar;
+  const uint32_t start;
+  std::vector<bool> nullable;
+  std::vector<Item> items;
+  std::vector<size_t> setBegin;
+
+  // Open addressing table of the items in the current set (indices into items) for deduplication.
+  // A slot is used if its stamp is the stamp of the current set, so starting a new set is O(1).
+  std::vector<uint32_t> slots;
+  std::vector<uint32_t> slotStamps;
+  uint32_t stamp;
+  size_t currentBegin;  // Index of the first item of the current set
+
+  void insertSlot(uint32_t index) {
+    const size_t mask = this->slots.size() - 1;
+    size_t i = ItemHash()(this->items[index]) & mask;
+    while (this->slotStamps[i] == this->stamp) i = (i + 1) & mask;
+    this->slots[i] = index;
+    this->slotStamps[i] = this->stamp;
   }
 
-  std::string str() const override {
-    std::string out = "";
-    for (auto& rule : this->options) {
-      out += rule->str() + "| ";
+  void startSet(size_t begin) {
+    this->currentBegin = begin;
+    if (++this->stamp == 0) {
+      std::fill(this->slotStamps.begin(), this->slotStamps.end(), 0);
+      this->stamp = 1;
     }
-    return out;
   }
-};
 
-std::vector<std::shared_ptr<Rule>> createRules(std::vector<std::string>& input) {
-  std::vector<std::shared_ptr<Rule>> rulesVector;
-  std::vector<std::string> splitValues;
-  for (auto& line : input) {
-    std::shared_ptr<Rule> newRule;
-    boost::split(splitValues, line, boost::is_any_of(":"));
-    size_t idx = atoi(splitValues[0].c_str());
-    if (splitValues[1][1] == '"') {
-      // FORMAT: 32: "a"
-      newRule = std::make_shared<Letter>(idx, splitValues[1][2]);
-    } else {
-      // any other format
-      newRule = std::make_shared<OrRule>(idx);
+  uint32_t nextSymbol(const Item& item) const {
+    const Grammar::Sequence sequence = this->grammar.getAlternative(item.rule, item.alt);
+    return item.dot < sequence.size() ? sequence[item.dot] : NONE;
+  }
+
+  bool isLetter(uint32_t rule) const { return this->grammar.isLetter(rule); }
+
+  void add(const Item& item) {
+    if (2 * (this->items.size() - this->currentBegin + 1) > this->slots.size()) {
+      this->slots.assign(2 * this->slots.size(), 0);
+      this->slotStamps.assign(this->slots.size(), 0);
+      for (size_t i = this->currentBegin; i < this->items.size(); ++i) this->insertSlot(i);
     }
-    if (idx >= rulesVector.size()) {
-      rulesVector.resize(idx + 1);
+    const size_t mask = this->slots.size() - 1;
+    for (size_t i = ItemHash()(item) & mask; this->slotStamps[i] == this->stamp; i = (i + 1) & mask) {
+      if (this->items[this->slots[i]] == item) return;
     }
-    rulesVector[idx] = newRule;
-    splitValues.clear();
+    this->items.push_back(item);
+    this->insertSlot(this->items.size() - 1);
   }
 
-  // Add pointers
-  for (auto& line : input) {
-    boost::split(splitValues, line, boost::is_any_of(":"));
-    size_t idx = atoi(splitValues[0].c_str());
+  void predict(uint32_t rule, uint32_t position) {
+    for (uint32_t a = 0; a < this->grammar.getNumAlternatives(rule); ++a) {
+      this->add({rule, a, 0, position});
+    }
+  }
 
-    if (splitValues[1][1] != '"') {  // Simple rules (letters) handeled above
-      std::string rules = splitValues[1];
-      splitValues.clear();
-      boost::split(splitValues, rules, boost::is_any_of("|"));
-      std::vector<std::shared_ptr<Rule>> orComposites;
+ public:
+  EarleyParser(const Grammar& grammar, uint32_t start)
+      : grammar(grammar),
+        start(start),
+        nullable(grammar.getNumRules(), false),
+        slots(64, 0),
+        slotStamps(64, 0),
+        stamp(0),
+        currentBegin(0) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (uint32_t r = 0; r < grammar.getNumRules(); ++r) {
+        if (this->nullable[r] || grammar.isLetter(r)) continue;
+        for (uint32_t a = 0; a < grammar.getNumAlternatives(r); ++a) {
+          const Grammar::Sequence sequence = grammar.getAlternative(r, a);
+          if (std::all_of(sequence.begin(), sequence.end(), [this](uint32_t sub) { return this->nullable[sub]; })) {
+            this->nullable[r] = true;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+  }
 
-      for (auto& ruleStr : splitValues) {
-        std::vector<std::string> v;
-        boost::split(v, ruleStr, boost::is_any_of(" "));
-        std::vector<std::shared_ptr<Rule>> composites;
+  bool matches(const std::string& message) {
+    if (this->isLetter(this->start)) {
+      return message.size() == 1 && message[0] == this->grammar.getLetter(this->start);
+    }
 
-        for (auto& idxStr : v) {
-          if (idxStr != "") {
-            composites.push_back(rulesVector[std::atoi(idxStr.c_str())]);
+    this->items.clear();
+    this->setBegin.clear();
+    this->startSet(0);
+    this->setBegin.push_back(0);
+    this->predict(this->start, 0);
+
+    for (uint32_t k = 0; k <= message.size(); ++k) {
+      // Predict and complete until the set doesn't grow anymore (the set grows while iterating)
+      for (size_t i = this->setBegin[k]; i < this->items.size(); ++i) {
+        const Item item = this->items[i];
+        const uint32_t symbol = this->nextSymbol(item);
+        if (symbol == NONE) {
+          const size_t end = item.origin == k ? this->items.size() : this->setBegin[item.origin + 1];
+          for (size_t j = this->setBegin[item.origin]; j < end; ++j) {
+            const Item waiting = this->items[j];
+            if (this->nextSymbol(waiting) == item.rule) {
+              this->add({waiting.rule, waiting.alt, waiting.dot + 1, waiting.origin});
+            }
           }
+        } else if (!this->isLetter(symbol)) {
+          this->predict(symbol, k);
+          if (this->nullable[symbol]) this->add({item.rule, item.alt, item.dot + 1, item.origin});
+        }
+      }
+      if (k == message.size()) break;
+
+      // Scan
+      const size_t end = this->items.size();
+      this->setBegin.push_back(end);
+      this->startSet(end);
+      for (size_t i = this->setBegin[k]; i < end; ++i) {
+        const Item item = this->items[i];
+        const uint32_t symbol = this->nextSymbol(item);
+        if (symbol != NONE && this->isLetter(symbol) && this->grammar.getLetter(symbol) == message[k]) {
+          this->add({item.rule, item.alt, item.dot + 1, item.origin});
         }
+      }
+      if (this->items.size() == end) return false;
+    }
 
-        orComposites.push_back(std::make_shared<CompositeRule>(CompositeRule(idx, composites)));
+    for (size_t i = this->setBegin.back(); i < this->items.size(); ++i) {
+      const Item& item = this->items[i];
+      if (item.rule == this->start && item.origin == 0 && this->nextSymbol(item) == NONE) return true;
+    }
+    return false;
+  }
+};
+
+// Recursive descent parser that remembers, for every (rule, position), the set of positions where the
+// rule can end. The sets are bitsets in one flat table that is reused for all messages, so no rule is
+// parsed twice at the same position. Left recursive rules don't match anything.
+class PackratParser {
+ private:
+  enum Status : uint8_t { NOT_PARSED, IN_PROGRESS, PARSED };
+
+  const Grammar& grammar;
+  const uint32_t start;
+  const std::string* message;
+  size_t numPositions;
+  size_t wordsPerSet;
+  std::vector<Status> status;     // numRules * numPositions
+  std::vector<uint64_t> ends;     // Same layout, wordsPerSet words per entry; the last entry is an empty set
+  std::vector<uint64_t> scratch;  // Stack of working sets for sequences
+  size_t scratchTop;
+
+  size_t emptySet() const { return this->status.size() * this->wordsPerSet; }
+
+  // Returns the offset of the set of end positions in `ends`
+  size_t parse(uint32_t rule, size_t position) {
+    const size_t slot = rule * this->numPositions + position;
+    const size_t result = slot * this->wordsPerSet;
+    if (this->status[slot] == PARSED) return result;
+    if (this->status[slot] == IN_PROGRESS) return this->emptySet();
+    this->status[slot] = IN_PROGRESS;
+    std::fill_n(this->ends.begin() + result, this->wordsPerSet, 0);
+
+    const char letter = this->grammar.getLetter(rule);
+    if (this->grammar.isLetter(rule)) {
+      if (position < this->message->size() && (*this->message)[position] == letter) {
+        this->ends[result + (position + 1) / 64] |= uint64_t(1) << ((position + 1) % 64);
       }
+      this->status[slot] = PARSED;
+      return result;
+    }
 
-      auto& r = static_cast<OrRule&>(*rulesVector[idx]);
-      r.init(orComposites);
+    const size_t current = this->scratchTop;
+    const size_t next = current + this->wordsPerSet;
+    this->scratchTop += 2 * this->wordsPerSet;
+    if (this->scratch.size() < this->scratchTop) this->scratch.resize(this->scratchTop);
+
+    for (uint32_t a = 0; a < this->grammar.getNumAlternatives(rule); ++a) {
+      const Grammar::Sequence sequence = this->grammar.getAlternative(rule, a);
+      std::fill_n(this->scratch.begin() + current, this->wordsPerSet, 0);
+      this->scratch[current + position / 64] |= uint64_t(1) << (position % 64);
+      bool empty = false;
+      for (uint32_t sub : sequence) {
+        std::fill_n(this->scratch.begin() + next, this->wordsPerSet, 0);
+        empty = true;
+        for (size_t w = position / 64; w < this->wordsPerSet; ++w) {
+          uint64_t bits = this->scratch[current + w];
+          while (bits != 0) {
+            const size_t p = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            const size_t subEnds = this->parse(sub, p);
+            for (size_t v = p / 64; v < this->wordsPerSet; ++v) {
+              this->scratch[next + v] |= this->ends[subEnds + v];
+            }
+          }
+        }
+        for (size_t w = 0; w < this->wordsPerSet; ++w) {
+          this->scratch[current + w] = this->scratch[next + w];
+          if (this->scratch[current + w] != 0) empty = false;
+        }
+        if (empty) break;
+      }
+      if (!empty) {
+        for (size_t w = 0; w < this->wordsPerSet; ++w) {
+          this->ends[result + w] |= this->scratch[current + w];
+        }
+      }
     }
-    splitValues.clear();
+
+    this->scratchTop -= 2 * this->wordsPerSet;
+    this->status[slot] = PARSED;
+    return result;
   }
-  return rulesVector;
-}
+
+ public:
+  PackratParser(const Grammar& grammar, uint32_t start)
+      : grammar(grammar), start(start), message(nullptr), numPositions(0), wordsPerSet(0), scratchTop(0) {}
+
+  bool matches(const std::string& message) {
+    this->message = &message;
+    this->numPositions = message.size() + 1;
+    this->wordsPerSet = (this->numPositions + 63) / 64;
+    this->status.assign(this->grammar.getNumRules() * this->numPositions, NOT_PARSED);
+    this->ends.resize((this->status.size() + 1) * this->wordsPerSet);
+    std::fill_n(this->ends.begin() + this->emptySet(), this->wordsPerSet, 0);
+
+    const size_t result = this->parse(this->start, 0);
+    return (this->ends[result + message.size() / 64] >> (message.size() % 64)) & 1;
+  }
+};
 
 std::vector<std::string> transformRules(std::vector<std::string> input) {
   for (int i = 0; i < input.size(); ++i) {
@@ -176,35 +512,77 @@ std::pair<std::vector<std::string>, std::vector<std::string>> splitInput(std::ve
   return std::pair(rules, messages);
 }
 
-void solve(std::vector<std::shared_ptr<Rule>>& rules, std::vector<std::string>& messages) {
-  std::shared_ptr<Rule> rule0 = rules[0];
-  int valid = 0;
+template <class Parser>
+unsigned int countValid(Parser& parser, std::vector<std::string>& messages) {
+  unsigned int valid = 0;
   for (auto& msg : messages) {
-    auto [success, positions] = rule0->parse(msg, 0);
-    if (!success) continue;
-    for (auto p : positions) {
-      if (p == msg.size()) {
-        ++valid;
-        break;
+    if (parser.matches(msg)) ++valid;
+  }
+  return valid;
+}
+
+// The grammar is only read, so every worker creates its own parser (with its own scratch buffers)
+// from it and counts the valid messages in one contiguous shard. The counts are summed at the end.
+template <class Parser>
+unsigned int countValidParallel(const Grammar& grammar, uint32_t start, std::vector<std::string>& messages,
+                                unsigned int numThreads) {
+  numThreads = std::max(1u, std::min<unsigned int>(numThreads, messages.size()));
+  const size_t chunk = (messages.size() + numThreads - 1) / numThreads;
+
+  std::vector<std::future<unsigned int>> futures;
+  for (size_t begin = 0; begin < messages.size(); begin += chunk) {
+    const size_t end = std::min(messages.size(), begin + chunk);
+    futures.push_back(std::async(std::launch::async, [&grammar, start, &messages, begin, end]() {
+      Parser parser(grammar, start);
+      unsigned int valid = 0;
+      for (size_t i = begin; i < end; ++i) {
+        if (parser.matches(messages[i])) ++valid;
       }
-    }
+      return valid;
+    }));
   }
-  std::cout << valid << std::endl;
+
+  unsigned int valid = 0;
+  for (auto& f : futures) {
+    valid += f.get();
+  }
+  return valid;
+}
+
+// Parsers for the rules of star 2 (which are recursive, so the Dfa can't be used).
+// Earley accepts any set of rules, packrat and backtracking fail on left recursive rules
+// (backtracking doesn't terminate) and backtracking takes exponential time in the worst case.
+enum class ParserKind { EARLEY, PACKRAT, BACKTRACKING };
+
+unsigned int countValidParallel(ParserKind kind, const Grammar& grammar, uint32_t start,
+                                std::vector<std::string>& messages, unsigned int numThreads) {
+  switch (kind) {
+    case ParserKind::EARLEY:
+      return countValidParallel<EarleyParser>(grammar, start, messages, numThreads);
+    case ParserKind::PACKRAT:
+      return countValidParallel<PackratParser>(grammar, start, messages, numThreads);
+    case ParserKind::BACKTRACKING:
+      return countValidParallel<BacktrackingParser>(grammar, start, messages, numThreads);
+  }
+  return 0;
 }
 
 int main() {
   const std::string filename = "../day-19/input.txt";
+  const ParserKind parser = ParserKind::EARLEY;
   auto input = aoc::readStringInput(filename);
   auto [rulesStr, messages] = splitInput(input);
 
   // Star 1
-  std::vector<std::shared_ptr<Rule>> rules = createRules(rulesStr);
-  solve(rules, messages);
+  Grammar grammar(rulesStr);
+  Dfa dfa(grammar, 0);
+  std::cout << countValid(dfa, messages) << std::endl;
 
   // Star 2
   std::vector<std::string> transformedRulesStr = transformRules(rulesStr);
-  std::vector<std::shared_ptr<Rule>> transformedRules = createRules(transformedRulesStr);
-  solve(transformedRules, messages);
+  Grammar transformedGrammar(transformedRulesStr);
+  const unsigned int numThreads = std::thread::hardware_concurrency();
+  std::cout << countValidParallel(parser, transformedGrammar, 0, messages, numThreads) << std::endl;
 
   return 0;
 }
@@ -1,3 +1,7 @@
+#include <atomic>
+#include <future>
+#include <mutex>
+
 #include "aoclib.hpp"
 
 unsigned int setBit(unsigned int value, size_t bit) {
@@ -57,6 +61,7 @@ class Tile {
   }
 
   unsigned int getId() const { return this->id; }
+  const std::vector<std::string>& getGrid() const { return this->grid; }
   std::vector<std::pair<unsigned int, unsigned int>> getBorders() const { return this->borders; }
   std::array<unsigned int, 4> getMatches() const { return this->matches; }
   bool isFixed() const { return this->fixed; }
@@ -381,6 +386,378 @@ void markMonsters(std::vector<std::string>& image) {
   }
 }
 
+// Image with one bit per pixel ('#' = 1), each row packed into 64-bit words
+class BitImage {
+ private:
+  size_t height;
+  size_t width;
+  size_t wordsPerRow;
+  std::vector<uint64_t> words;
+
+ public:
+  BitImage(size_t height, size_t width)
+      : height(height), width(width), wordsPerRow((width + 63) / 64), words(height * ((width + 63) / 64), 0) {}
+
+  static BitImage fromStrings(const std::vector<std::string>& image) {
+    BitImage bits(image.size(), image.empty() ? 0 : image[0].size());
+    for (size_t i = 0; i < image.size(); ++i) {
+      for (size_t j = 0; j < image[i].size(); ++j) {
+        if (image[i][j] == '#') bits.set(i, j);
+      }
+    }
+    return bits;
+  }
+
+  size_t getHeight() const { return this->height; }
+  size_t getWidth() const { return this->width; }
+  size_t getWordsPerRow() const { return this->wordsPerRow; }
+  uint64_t* row(size_t i) { return &this->words[i * this->wordsPerRow]; }
+  const uint64_t* row(size_t i) const { return &this->words[i * this->wordsPerRow]; }
+
+  bool get(size_t i, size_t j) const { return (this->row(i)[j / 64] >> (j % 64)) & 1; }
+  void set(size_t i, size_t j) { this->row(i)[j / 64] |= uint64_t(1) << (j % 64); }
+
+  // Returns 64 bits of row i, starting at column 64 * word + shift
+  uint64_t readShifted(size_t i, size_t word, size_t shift) const {
+    size_t first = word + shift / 64;
+    size_t offset = shift % 64;
+    if (first >= this->wordsPerRow) return 0;
+    uint64_t value = this->row(i)[first] >> offset;
+    if (offset != 0 && first + 1 < this->wordsPerRow) {
+      value |= this->row(i)[first + 1] << (64 - offset);
+    }
+    return value;
+  }
+
+  // ORs mask into row i, with bit 0 of mask landing on column j
+  void orMaskAt(size_t i, size_t j, uint64_t mask) {
+    size_t word = j / 64;
+    size_t offset = j % 64;
+    this->row(i)[word] |= mask << offset;
+    if (offset != 0 && word + 1 < this->wordsPerRow) {
+      this->row(i)[word + 1] |= mask >> (64 - offset);
+    }
+  }
+
+  BitImage& operator|=(const BitImage& other) {
+    for (size_t k = 0; k < this->words.size(); ++k) {
+      this->words[k] |= other.words[k];
+    }
+    return *this;
+  }
+};
+
+// Pattern (at most 64 pixels wide) encoded as one mask per row
+struct BitPattern {
+  size_t height;
+  size_t width;
+  std::vector<uint64_t> rows;
+
+  BitPattern(const std::vector<std::string>& pattern) : height(pattern.size()), width(pattern[0].size()) {
+    if (this->width > 64) {
+      std::cerr << "Pattern too wide: " << this->width << std::endl;
+      std::terminate();
+    }
+    for (const std::string& line : pattern) {
+      uint64_t mask = 0;
+      for (size_t j = 0; j < line.size(); ++j) {
+        if (line[j] == '#') mask |= uint64_t(1) << j;
+      }
+      this->rows.push_back(mask);
+    }
+  }
+};
+
+// Returns a word with bit b set if the pattern's top-left corner can be placed at (i, 64 * w + b).
+// All 64 offsets of a word are tested at once by shifting the image rows and ANDing them together.
+uint64_t matchPatternAt(const BitImage& image, const BitPattern& pattern, size_t i, size_t w) {
+  const size_t lastCol = image.getWidth() - pattern.width;
+  uint64_t candidates = ~uint64_t(0);
+  if (lastCol - w * 64 < 63) {
+    candidates = (uint64_t(1) << (lastCol - w * 64 + 1)) - 1;
+  }
+  for (size_t k = 0; k < pattern.height && candidates != 0; ++k) {
+    uint64_t mask = pattern.rows[k];
+    while (mask != 0 && candidates != 0) {
+      size_t shift = __builtin_ctzll(mask);
+      candidates &= image.readShifted(i + k, w, shift);
+      mask &= mask - 1;
+    }
+  }
+  return candidates;
+}
+
+// All 8 orientations (4 rotations, flipped and not flipped) of a pattern
+std::vector<std::vector<std::string>> getOrientations(std::vector<std::string> pattern) {
+  std::vector<std::vector<std::string>> orientations;
+  for (size_t f = 0; f < 2; ++f) {
+    for (size_t i = 0; i < 4; ++i) {
+      orientations.push_back(pattern);
+      pattern = Tile::rotateImageLeft(pattern);
+    }
+    pattern = Tile::flipImage(pattern);
+  }
+  return orientations;
+}
+
+struct Occurrence {
+  size_t pattern;
+  size_t orientation;  // Index into getOrientations(pattern)
+  size_t row;
+  size_t col;
+};
+
+// Searches for several ASCII patterns ('#' has to match, anything else is ignored) in all 8 orientations.
+// Orientations that look the same (symmetric patterns) are only searched for once.
+class PatternSearch {
+ private:
+  struct Compiled {
+    size_t pattern;
+    size_t orientation;
+    BitPattern bits;
+  };
+  std::vector<Compiled> compiled;
+  std::vector<std::vector<std::string>> patterns;
+
+  void findInRows(const BitImage& image, size_t rowBegin, size_t rowEnd, std::vector<Occurrence>& out) const {
+    for (size_t i = rowBegin; i < rowEnd; ++i) {
+      for (const Compiled& c : this->compiled) {
+        const BitPattern& p = c.bits;
+        if (i + p.height > image.getHeight() || p.width > image.getWidth()) continue;
+        const size_t lastCol = image.getWidth() - p.width;
+        for (size_t w = 0; w < image.getWordsPerRow() && w * 64 <= lastCol; ++w) {
+          uint64_t starts = matchPatternAt(image, p, i, w);
+          while (starts != 0) {
+            out.push_back({c.pattern, c.orientation, i, w * 64 + __builtin_ctzll(starts)});
+            starts &= starts - 1;
+          }
+        }
+      }
+    }
+  }
+
+ public:
+  PatternSearch(std::vector<std::vector<std::string>> patterns) : patterns(patterns) {
+    for (size_t p = 0; p < patterns.size(); ++p) {
+      auto orientations = getOrientations(patterns[p]);
+      for (size_t o = 0; o < orientations.size(); ++o) {
+        auto first = std::find(orientations.begin(), orientations.end(), orientations[o]);
+        if (static_cast<size_t>(first - orientations.begin()) != o) continue;
+        this->compiled.push_back({p, o, BitPattern(orientations[o])});
+      }
+    }
+  }
+
+  // Finds all (possibly overlapping) occurrences, ordered by row. Every row is visited once
+  // and all patterns are matched against it while it is still in cache.
+  std::vector<Occurrence> find(const BitImage& image, unsigned int numThreads = 1) const {
+    std::vector<Occurrence> occurrences;
+    const size_t height = image.getHeight();
+    if (numThreads <= 1 || height < numThreads) {
+      this->findInRows(image, 0, height, occurrences);
+      return occurrences;
+    }
+
+    std::vector<std::future<std::vector<Occurrence>>> futures;
+    const size_t chunk = (height + numThreads - 1) / numThreads;
+    for (size_t begin = 0; begin < height; begin += chunk) {
+      size_t end = std::min(height, begin + chunk);
+      futures.push_back(std::async(std::launch::async, [this, &image, begin, end]() {
+        std::vector<Occurrence> part;
+        this->findInRows(image, begin, end, part);
+        return part;
+      }));
+    }
+    for (auto& f : futures) {
+      auto part = f.get();
+      occurrences.insert(occurrences.end(), part.begin(), part.end());
+    }
+    return occurrences;
+  }
+
+  // Returns a bit image with all pixels that are covered by any of the occurrences
+  BitImage cover(const BitImage& image, const std::vector<Occurrence>& occurrences) const {
+    BitImage covered(image.getHeight(), image.getWidth());
+    for (const Occurrence& occ : occurrences) {
+      auto it = std::find_if(this->compiled.begin(), this->compiled.end(), [&occ](const Compiled& c) {
+        return c.pattern == occ.pattern && c.orientation == occ.orientation;
+      });
+      for (size_t k = 0; k < it->bits.height; ++k) {
+        covered.orMaskAt(occ.row + k, occ.col, it->bits.rows[k]);
+      }
+    }
+    return covered;
+  }
+};
+
+// Same result as markMonsters, but works on a bit-packed image
+void markMonstersBitwise(std::vector<std::string>& image, unsigned int numThreads = 1) {
+  const BitImage bits = BitImage::fromStrings(image);
+  const PatternSearch search({getMonster()});
+
+  BitImage monsters = search.cover(bits, search.find(bits, numThreads));
+
+  for (size_t i = 0; i < image.size(); ++i) {
+    for (size_t j = 0; j < image[i].size(); ++j) {
+      if (monsters.get(i, j)) image[i][j] = 'O';
+    }
+  }
+}
+
+// Borders of a tile in one of its 8 orientations. Borders are read left to right or top to bottom.
+struct OrientedTile {
+  unsigned int id;
+  size_t orientation;  // Index into getOrientations(grid)
+  unsigned int top;
+  unsigned int right;
+  unsigned int bottom;
+  unsigned int left;
+};
+
+// Assembles the image by backtracking over all tile placements, so it also works when a border
+// matches more than one other tile. Cells are filled row by row and the candidates for a cell are
+// looked up in an index by the border of the tile on the left (or above).
+class BacktrackingAssembler {
+ private:
+  size_t side;
+  size_t numTiles;
+  std::vector<OrientedTile> options;  // Orientations of tile t are at [8 * t, 8 * t + 8)
+  std::unordered_map<unsigned int, std::vector<size_t>> byLeft;
+  std::unordered_map<unsigned int, std::vector<size_t>> byTop;
+  std::atomic<bool> done;
+  std::mutex solutionMutex;
+  std::vector<size_t> solution;
+
+  static unsigned int readBorder(const std::vector<std::string>& grid, bool row, size_t idx) {
+    unsigned int value = 0;
+    for (size_t k = 0; k < grid.size(); ++k) {
+      char c = row ? grid[idx][k] : grid[k][idx];
+      if (c == '#') value |= 1u << k;
+    }
+    return value;
+  }
+
+  const std::vector<size_t>& lookup(const std::unordered_map<unsigned int, std::vector<size_t>>& index,
+                                    unsigned int border) const {
+    static const std::vector<size_t> empty;
+    auto it = index.find(border);
+    return it == index.end() ? empty : it->second;
+  }
+
+  // Some unused tile (other than `tile`) has to fit next to this border
+  bool hasPartner(const std::unordered_map<unsigned int, std::vector<size_t>>& index, unsigned int border,
+                  size_t tile, const std::vector<bool>& used) const {
+    for (size_t o : this->lookup(index, border)) {
+      if (o / 8 != tile && !used[o / 8]) return true;
+    }
+    return false;
+  }
+
+  bool fits(size_t o, const std::vector<size_t>& placed, const std::vector<bool>& used) const {
+    const size_t cell = placed.size();
+    const size_t i = cell / this->side;
+    const size_t j = cell % this->side;
+    const OrientedTile& t = this->options[o];
+    if (used[o / 8]) return false;
+    if (j > 0 && this->options[placed[cell - 1]].right != t.left) return false;
+    if (i > 0 && this->options[placed[cell - this->side]].bottom != t.top) return false;
+    // Forward check: the neighbours to the right and below must still be placeable
+    if (j + 1 < this->side && !this->hasPartner(this->byLeft, t.right, o / 8, used)) return false;
+    if (i + 1 < this->side && !this->hasPartner(this->byTop, t.bottom, o / 8, used)) return false;
+    return true;
+  }
+
+  bool search(std::vector<size_t>& placed, std::vector<bool>& used) {
+    if (this->done) return false;
+    const size_t cell = placed.size();
+    if (cell == this->numTiles) return true;
+
+    const std::vector<size_t>& candidates =
+        cell % this->side > 0 ? this->lookup(this->byLeft, this->options[placed[cell - 1]].right)
+                              : this->lookup(this->byTop, this->options[placed[cell - this->side]].bottom);
+    for (size_t o : candidates) {
+      if (!this->fits(o, placed, used)) continue;
+      placed.push_back(o);
+      used[o / 8] = true;
+      if (this->search(placed, used)) return true;
+      used[o / 8] = false;
+      placed.pop_back();
+    }
+    return false;
+  }
+
+ public:
+  BacktrackingAssembler(const std::unordered_map<unsigned int, std::unique_ptr<Tile>>& tiles)
+      : side(sqrt(tiles.size())), numTiles(tiles.size()), done(false) {
+    for (auto& tile : tiles) {
+      auto orientations = getOrientations(tile.second->getGrid());
+      for (size_t o = 0; o < orientations.size(); ++o) {
+        auto& grid = orientations[o];
+        const size_t last = grid.size() - 1;
+        this->byLeft[readBorder(grid, false, 0)].push_back(this->options.size());
+        this->byTop[readBorder(grid, true, 0)].push_back(this->options.size());
+        this->options.push_back({tile.first, o, readBorder(grid, true, 0), readBorder(grid, false, last),
+                                 readBorder(grid, true, last), readBorder(grid, false, 0)});
+      }
+    }
+  }
+
+  // Returns (tile id, orientation) for each cell in row-major order, or an empty vector if the
+  // tiles can't be assembled. Each choice for the top-left cell is a separate task; idle workers
+  // take the next task from a shared counter until one of them finds a solution.
+  std::vector<std::pair<unsigned int, size_t>> assemble(unsigned int numThreads = 1) {
+    std::atomic<size_t> nextRoot(0);
+    auto worker = [this, &nextRoot]() {
+      std::vector<size_t> placed;
+      std::vector<bool> used(this->numTiles, false);
+      for (size_t o = nextRoot++; o < this->options.size() && !this->done; o = nextRoot++) {
+        placed.clear();
+        if (!this->fits(o, placed, used)) continue;
+        placed.push_back(o);
+        used[o / 8] = true;
+        if (this->search(placed, used)) {
+          std::lock_guard<std::mutex> lock(this->solutionMutex);
+          if (!this->done) {
+            this->solution = placed;
+            this->done = true;
+          }
+        }
+        used.assign(this->numTiles, false);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < numThreads; ++t) {
+      threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    std::vector<std::pair<unsigned int, size_t>> placement;
+    for (size_t o : this->solution) {
+      placement.push_back({this->options[o].id, this->options[o].orientation});
+    }
+    return placement;
+  }
+};
+
+// Builds the image from a placement returned by BacktrackingAssembler
+std::vector<std::string> constructImage(std::unordered_map<unsigned int, std::unique_ptr<Tile>>& tiles,
+                                        std::vector<std::pair<unsigned int, size_t>>& placement) {
+  const size_t side = sqrt(placement.size());
+  const size_t tileSize = tiles.begin()->second->getGrid().size();
+  std::vector<std::string> image(side * tileSize, "");
+  for (size_t cell = 0; cell < placement.size(); ++cell) {
+    auto subimage = getOrientations(tiles[placement[cell].first]->getGrid())[placement[cell].second];
+    for (size_t k = 0; k < subimage.size(); ++k) {
+      image[cell / side * tileSize + k] += subimage[k];
+    }
+  }
+  return image;
+}
+
 void part1(std::unordered_map<unsigned int, std::unique_ptr<Tile>>& tiles) {
   unsigned long product = 1;
   for (auto& tile : tiles) {
@@ -404,6 +781,8 @@ void part2(std::vector<std::string>& image) {
 
 int main() {
   const std::string filename = "../day-20/input.txt";
+  const bool backtracking = true;  // false assembles the tiles greedily
+  const bool bitwise = true;       // false searches the monsters character by character
   std::vector<std::string> input = aoc::readStringInput(filename);
 
   std::unordered_map<unsigned int, std::unique_ptr<Tile>> tiles = createTiles(input);
@@ -418,12 +797,26 @@ int main() {
 
   part1(tiles);
 
+  std::vector<std::pair<unsigned int, size_t>> placement;
+  if (backtracking) {
+    BacktrackingAssembler assembler(tiles);
+    placement = assembler.assemble(std::thread::hardware_concurrency());
+    if (placement.empty()) {
+      std::cerr << "Tiles can't be assembled" << std::endl;
+      return 1;
+    }
+  }
+
   for (auto& t : tiles) {
     t.second->removeBorders();
   }
 
-  std::vector<std::string> image = constructImage(tiles);
-  markMonsters(image);
+  std::vector<std::string> image = backtracking ? constructImage(tiles, placement) : constructImage(tiles);
+  if (bitwise) {
+    markMonstersBitwise(image, std::thread::hardware_concurrency());
+  } else {
+    markMonsters(image);
+  }
 
   part2(image);
 